@@ -0,0 +1,240 @@
+/*
+pascallite.c
+- ReadInt, WriteInt, Crlf, WriteString, ReadInts, WriteInts and Exit for programs compiled by stage1 with
+  --runtime=pascallite (i386) or --target=x86-64, in place of Along32.o
+- Output is collected in a 64 KiB buffer and written when it fills and at
+  Exit; input is read in 64 KiB blocks and parsed from the buffer
+- Like Along32, every entry point preserves all registers except eax from
+  ReadInt; Exit flushes the output and ends the program with status 0
+- ReadInts and WriteInts take a count in ecx and the address of that many
+  dwords in esi (rsi), for a whole read or write statement in one call
+- WriteString writes the NUL-terminated string at edx (rdx), as in Along32;
+  stage1 uses it for output it could format at compile time
+- Freestanding: raw Linux system calls, no C library
+- Built with -DPASCALLITE_UNBUFFERED, every WriteInt, Crlf and WriteString
+  makes its own write system call instead, as Along32 does; bench output
+  times the two against each other
+
+Build and link (i386):
+    gcc -m32 -c -O2 -ffreestanding -fno-stack-protector -fno-pic pascallite.c
+    stage1 prog.dat prog.lst prog.o --runtime=pascallite --elf
+    ld -m elf_i386 -o prog prog.o pascallite.o
+Build and link (x86-64):
+    gcc -c -O2 -ffreestanding -fno-stack-protector -fno-pic pascallite.c
+    stage1 prog.dat prog.lst prog.o --target=x86-64 --elf
+    ld -o prog prog.o pascallite.o
+(or assemble stage1's NASM output with nasm -f elf32 / -f elf64)
+*/
+
+#if defined(__x86_64__)
+#define SYS_READ 0
+#define SYS_WRITE 1
+#define SYS_EXIT 60
+static long sys3(long n, long a, long b, long c)
+{
+    long r;
+    __asm__ volatile ("syscall" : "=a"(r) : "a"(n), "D"(a), "S"(b), "d"(c)
+                      : "rcx", "r11", "memory");
+    return r;
+}
+#else
+#define SYS_READ 3
+#define SYS_WRITE 4
+#define SYS_EXIT 1
+static long sys3(long n, long a, long b, long c)
+{
+    long r;
+    __asm__ volatile ("int $0x80" : "=a"(r) : "a"(n), "b"(a), "c"(b), "d"(c) : "memory");
+    return r;
+}
+#endif
+
+#define BUFFER_SIZE 65536
+#ifdef PASCALLITE_UNBUFFERED
+#define UNBUFFERED 1
+#else
+#define UNBUFFERED 0
+#endif
+
+static char inBuf[BUFFER_SIZE];
+static long inLen = 0, inPos = 0;
+static char outBuf[BUFFER_SIZE];
+static long outLen = 0;
+
+static int nextByte(void)
+{
+    if (inPos >= inLen) {
+        inLen = sys3(SYS_READ, 0, (long)inBuf, sizeof inBuf);
+        inPos = 0;
+        if (inLen <= 0) return -1;
+    }
+    return inBuf[inPos++];
+}
+
+static void flush(void)
+{
+    long done = 0;
+    while (done < outLen) {
+        long n = sys3(SYS_WRITE, 1, (long)(outBuf + done), outLen - done);
+        if (n <= 0) break;                  /* nowhere to report it */
+        done += n;
+    }
+    outLen = 0;
+}
+
+/* Optionally signed decimal; leading white space is skipped, 0 at end of input */
+int pascalliteReadInt(void)
+{
+    int c = nextByte();
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r') c = nextByte();
+    int negative = 0;
+    if (c == '-' || c == '+') {
+        negative = (c == '-');
+        c = nextByte();
+    }
+    unsigned value = 0;
+    while (c >= '0' && c <= '9') {
+        value = value * 10 + (unsigned)(c - '0');
+        c = nextByte();
+    }
+    return (int)(negative ? 0u - value : value); /* no overflow at -2147483648 */
+}
+
+/* Signed decimal with a leading + or -, as Along32's WriteInt prints it */
+void pascalliteWriteInt(int v)
+{
+    char digits[10];
+    int n = 0;
+    unsigned u = v < 0 ? 0u - (unsigned)v : (unsigned)v;
+    do {
+        digits[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (outLen + n + 1 > BUFFER_SIZE) flush();
+    outBuf[outLen++] = v < 0 ? '-' : '+';
+    while (n) outBuf[outLen++] = digits[--n];
+    if (UNBUFFERED) flush();
+}
+
+void pascalliteCrlf(void)
+{
+    if (outLen == BUFFER_SIZE) flush();
+    outBuf[outLen++] = '\n';
+    if (UNBUFFERED) flush();
+}
+
+void pascalliteWriteString(const char *s)
+{
+    while (*s) {
+        if (outLen == BUFFER_SIZE) flush();
+        outBuf[outLen++] = *s++;
+    }
+    if (UNBUFFERED) flush();
+}
+
+void pascalliteReadInts(int *values, int count)
+{
+    for (int k = 0; k < count; ++k) values[k] = pascalliteReadInt();
+}
+
+/* Each value on its own line, as WriteInt and Crlf print it */
+void pascalliteWriteInts(const int *values, int count)
+{
+    for (int k = 0; k < count; ++k) {
+        pascalliteWriteInt(values[k]);
+        pascalliteCrlf();
+    }
+}
+
+void pascalliteExit(void)
+{
+    flush();
+    sys3(SYS_EXIT, 0, 0, 0);
+}
+
+/* Register-preserving entry points; the stack is realigned for the C calls */
+#if defined(__x86_64__)
+__asm__(
+    ".intel_syntax noprefix\n"
+    ".text\n"
+    ".macro SAVE_REGS\n"
+    "    push rbp\n    mov rbp, rsp\n    and rsp, -16\n"
+    "    push rcx\n    push rdx\n    push rsi\n    push rdi\n"
+    "    push r8\n    push r9\n    push r10\n    push r11\n"
+    ".endm\n"
+    ".macro RESTORE_REGS\n"
+    "    pop r11\n    pop r10\n    pop r9\n    pop r8\n"
+    "    pop rdi\n    pop rsi\n    pop rdx\n    pop rcx\n"
+    "    mov rsp, rbp\n    pop rbp\n"
+    ".endm\n"
+    ".globl ReadInt\n"
+    "ReadInt:\n"
+    "    SAVE_REGS\n    call pascalliteReadInt\n    RESTORE_REGS\n    ret\n"
+    ".globl WriteInt\n"
+    "WriteInt:\n"
+    "    SAVE_REGS\n    push rax\n    push rax\n    mov edi, eax\n"
+    "    call pascalliteWriteInt\n    pop rax\n    pop rax\n    RESTORE_REGS\n    ret\n"
+    ".globl Crlf\n"
+    "Crlf:\n"
+    "    SAVE_REGS\n    push rax\n    push rax\n"
+    "    call pascalliteCrlf\n    pop rax\n    pop rax\n    RESTORE_REGS\n    ret\n"
+    ".globl WriteString\n"
+    "WriteString:\n"
+    "    SAVE_REGS\n    push rax\n    push rax\n    mov rdi, rdx\n"
+    "    call pascalliteWriteString\n    pop rax\n    pop rax\n    RESTORE_REGS\n    ret\n"
+    ".globl ReadInts\n"
+    "ReadInts:\n"
+    "    SAVE_REGS\n    push rax\n    push rax\n    mov rdi, rsi\n    mov esi, ecx\n"
+    "    call pascalliteReadInts\n    pop rax\n    pop rax\n    RESTORE_REGS\n    ret\n"
+    ".globl WriteInts\n"
+    "WriteInts:\n"
+    "    SAVE_REGS\n    push rax\n    push rax\n    mov rdi, rsi\n    mov esi, ecx\n"
+    "    call pascalliteWriteInts\n    pop rax\n    pop rax\n    RESTORE_REGS\n    ret\n"
+    ".globl Exit\n"
+    "Exit:\n"
+    "    and rsp, -16\n    call pascalliteExit\n"
+    ".att_syntax prefix\n");
+#else
+/* cdecl already keeps ebx, esi, edi and ebp */
+__asm__(
+    ".intel_syntax noprefix\n"
+    ".text\n"
+    ".globl ReadInt\n"
+    "ReadInt:\n"
+    "    push ebp\n    mov ebp, esp\n    push ecx\n    push edx\n    and esp, -16\n"
+    "    call pascalliteReadInt\n"
+    "    lea esp, [ebp-8]\n    pop edx\n    pop ecx\n    pop ebp\n    ret\n"
+    ".globl WriteInt\n"
+    "WriteInt:\n"
+    "    push ebp\n    mov ebp, esp\n    push eax\n    push ecx\n    push edx\n"
+    "    and esp, -16\n    sub esp, 12\n    push eax\n"
+    "    call pascalliteWriteInt\n"
+    "    lea esp, [ebp-12]\n    pop edx\n    pop ecx\n    pop eax\n    pop ebp\n    ret\n"
+    ".globl Crlf\n"
+    "Crlf:\n"
+    "    push ebp\n    mov ebp, esp\n    push eax\n    push ecx\n    push edx\n    and esp, -16\n"
+    "    call pascalliteCrlf\n"
+    "    lea esp, [ebp-12]\n    pop edx\n    pop ecx\n    pop eax\n    pop ebp\n    ret\n"
+    ".globl WriteString\n"
+    "WriteString:\n"
+    "    push ebp\n    mov ebp, esp\n    push eax\n    push ecx\n    push edx\n"
+    "    and esp, -16\n    sub esp, 12\n    push edx\n"
+    "    call pascalliteWriteString\n"
+    "    lea esp, [ebp-12]\n    pop edx\n    pop ecx\n    pop eax\n    pop ebp\n    ret\n"
+    ".globl ReadInts\n"
+    "ReadInts:\n"
+    "    push ebp\n    mov ebp, esp\n    push eax\n    push ecx\n    push edx\n"
+    "    and esp, -16\n    sub esp, 8\n    push ecx\n    push esi\n"
+    "    call pascalliteReadInts\n"
+    "    lea esp, [ebp-12]\n    pop edx\n    pop ecx\n    pop eax\n    pop ebp\n    ret\n"
+    ".globl WriteInts\n"
+    "WriteInts:\n"
+    "    push ebp\n    mov ebp, esp\n    push eax\n    push ecx\n    push edx\n"
+    "    and esp, -16\n    sub esp, 8\n    push ecx\n    push esi\n"
+    "    call pascalliteWriteInts\n"
+    "    lea esp, [ebp-12]\n    pop edx\n    pop ecx\n    pop eax\n    pop ebp\n    ret\n"
+    ".globl Exit\n"
+    "Exit:\n"
+    "    and esp, -16\n    call pascalliteExit\n"
+    ".att_syntax prefix\n");
+#endif
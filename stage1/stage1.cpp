@@ -21,6 +21,17 @@ stage1.cpp
 #include <chrono>       // for time
 #include <ctime>
 #include <algorithm>    // for std::find_if, std::remove_if, std::isspace
+#include <tuple>        // value numbering keys
+#include <cstring>      // std::strlen
+
+#if defined(__x86_64__) && defined(__linux__)
+#define STAGE1_CAN_RUN 1    // --run maps and calls the generated code
+#include <sys/mman.h>       // mmap, mprotect
+#include <unistd.h>         // sysconf
+#endif
+#ifdef __unix__
+#include <unistd.h>         // getpid, for --trace
+#endif
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -107,7 +118,8 @@ Compiler::Compiler(char **argv){        // constructor
     // Open files (argv indices assumed valid by main)
     sourceFile.open(argv[1]);
     listingFile.open(argv[2]);
-    objectFile.open(argv[3]);
+    objectFileName = argv[3];   // opened by checkOptions(), once --elf or --run is known
+    sourceFileName = argv[1];
 
     // Initialize static global sets
     keywords = {"program", "const", "var", "begin", "end", "integer", "boolean", "true", "false", "not", "read", "write"};
@@ -121,9 +133,79 @@ Compiler::Compiler(char **argv){        // constructor
     if (!listingFile.is_open()) {
         processError(std::string("Unable to open listing file: ") + argv[2]);
     }
+}
+
+bool Compiler::setOption(string opt){
+    // --ast[=file] dumps the syntax tree as JSON (README: ast.json)
+    if (opt == "--ast") {
+        astFileName = "ast.json";
+    } else if (opt.compare(0, 6, "--ast=") == 0 && opt.size() > 6) {
+        astFileName = opt.substr(6);
+    // --ir[=file] dumps the three-address code (README: ir.txt)
+    } else if (opt == "--ir") {
+        irFileName = "ir.txt";
+    } else if (opt.compare(0, 5, "--ir=") == 0 && opt.size() > 5) {
+        irFileName = opt.substr(5);
+    // --layout[=file] reports where emitStorage() put each name (layout.txt)
+    } else if (opt == "--layout") {
+        layoutFileName = "layout.txt";
+    } else if (opt.compare(0, 9, "--layout=") == 0 && opt.size() > 9) {
+        layoutFileName = opt.substr(9);
+    // --target=x86-64 generates 64-bit code for the x86-64 runtime (runtime/)
+    } else if (opt == "--target=x86-64" || opt == "--target=i386") {
+        target64 = (opt == "--target=x86-64");
+        i386Requested = !target64;
+    // --runtime=pascallite links i386 code with runtime/pascallite.c, not Along32
+    } else if (opt == "--runtime=pascallite" || opt == "--runtime=along32") {
+        ownRuntime = (opt == "--runtime=pascallite");
+    // --pack-booleans stores boolean variables in a byte each (0 or -1)
+    } else if (opt == "--pack-booleans") {
+        packBooleans = true;
+    // --trace[=file] writes Chrome trace events (trace.json); --trace-min=N
+    // folds spans under N microseconds into per-name totals
+    } else if (opt == "--trace") {
+        traceFileName = "trace.json";
+        trace.enabled = true;
+    } else if (opt.compare(0, 8, "--trace=") == 0 && opt.size() > 8) {
+        traceFileName = opt.substr(8);
+        trace.enabled = true;
+    } else if (opt.compare(0, 12, "--trace-min=") == 0 && opt.size() > 12) {
+        char *end = nullptr;
+        trace.minMicros = std::strtod(opt.c_str() + 12, &end);
+        if (*end != '\0' || trace.minMicros < 0) return false;
+    // --stats[=json] times each phase and counts what was produced (stderr)
+    } else if (opt == "--stats" || opt == "--stats=json") {
+        stats.enabled = true;
+        stats.json = (opt == "--stats=json");
+    // --run encodes x86-64 code into memory and executes it; no object file
+    } else if (opt == "--run") {
+        runProgram = elfOutput = true;
+    // --elf writes ObjectFileName as a linkable ELF .o, so nasm is not needed
+    } else if (opt == "--elf") {
+        elfOutput = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool Compiler::checkOptions(){
+    // After the last setOption(), so the result does not depend on the
+    // order of the options
+    if (runProgram && i386Requested) {
+        std::cerr << "ERROR: --run executes x86-64 code and cannot be combined with --target=i386" << std::endl;
+        return false;
+    }
+    if (runProgram) {
+        target64 = true;
+        return true;            // nothing is written to ObjectFileName
+    }
+    objectFile.open(objectFileName, elfOutput ? std::ios::out | std::ios::binary | std::ios::trunc
+                                              : std::ios::out | std::ios::trunc);
     if (!objectFile.is_open()) {
-        processError(std::string("Unable to open object file: ") + argv[3]);
+        processError("Unable to open object file: " + objectFileName);
     }
+    return true;
 }
 
 Compiler::~Compiler(){  // destructor
@@ -147,6 +229,7 @@ void Compiler::createListingHeader(){
 }
 
 void Compiler::parser(){
+    PhaseScope timing(*this, STAT_PARSE);
     // Ensure ch is initialized to first character of source file
     ch = nextChar(); // nextChar is expected to be implemented elsewhere
     token = nextToken(); // prime the first token
@@ -160,10 +243,12 @@ void Compiler::parser(){
 }
 
 void Compiler::createListingTrailer() {
+    PhaseScope timing(*this, STAT_OUTPUT);
     std::string errorWord = (errorCount == 1) ? "ERROR" : "ERRORS";
 
-    // Output to console
-    std::cout << "COMPILATION TERMINATED\t\t"
+    // Output to console; under --run stdout carries only the program's output
+    std::ostream &console = runProgram ? std::cerr : std::cout;
+    console << "COMPILATION TERMINATED\t\t"
               << errorCount << " " << errorWord << " ENCOUNTERED"
               << std::endl;
 
@@ -173,6 +258,15 @@ void Compiler::createListingTrailer() {
                     << errorCount << " " << errorWord << " ENCOUNTERED"
                     << std::endl;
     }
+    objectFile.flush();         // so --stats counts writing it
+
+    if (!traceFileName.empty()) {   // after parser(), so every span has ended
+        std::ofstream traceFile(traceFileName.c_str());
+        if (!traceFile.is_open()) {
+            std::cerr << "ERROR: Unable to open trace file: " << traceFileName << std::endl;
+        }
+        trace.write(traceFile, sourceFileName);
+    }
 }
 
 /* ------------------------------------------------------
@@ -180,6 +274,7 @@ void Compiler::createListingTrailer() {
     ------------------------------------------------------ */
 
 void Compiler::prog(){  // stage0, prod 1
+    TraceScope span(*this, __func__);
     // Expect token to be "program" on entry
     if (token != "program") {
         processError("keyword \"program\" expected");
@@ -212,6 +307,7 @@ void Compiler::prog(){  // stage0, prod 1
 }
 
 void Compiler::progStmt(){      // stage 0, prod 2
+    TraceScope span(*this, __func__);
     // On entry token should be program name (already consumed "program")
     std::string x;
 
@@ -232,10 +328,12 @@ void Compiler::progStmt(){      // stage 0, prod 2
     token = nextToken();        // advance to next token after semicolon
     // Insert program name into symbol table
     insert(x, PROG_NAME, CONSTANT, x, NO, 0);
+    astRoot = ast.newNode(AST_PROGRAM, x, lineNo);
     code("program", x);
 }
 
 void Compiler::consts(){        // stage0, prod 3
+    TraceScope span(*this, __func__);
     // token is "const" on entry
     token = nextToken();        // advance to first identifier (or error)
     if (!isNonKeyId(token)) {
@@ -251,6 +349,7 @@ void Compiler::consts(){        // stage0, prod 3
 }
 
 void Compiler::vars(){  // stage 0, prod 4
+    TraceScope span(*this, __func__);
     // token is "var" on entry
     token = nextToken();        // advance to first identifier (or error)
     if (!isNonKeyId(token)) {
@@ -266,6 +365,7 @@ void Compiler::vars(){  // stage 0, prod 4
 }
 
 void Compiler::beginEndStmt(){  // stage 1, prod 5
+    TraceScope span(*this, __func__);
     // token is "begin" on entry
     token = nextToken();        // move to first token inside the block
 
@@ -285,10 +385,50 @@ void Compiler::beginEndStmt(){  // stage 1, prod 5
         token = nextToken();    // consume '.' and advance (should be EOF)
     }
 
-    code("end", ".");           // emit epilogue + storage
+    // The whole body is parsed; translate it to IR, check it and lower it
+    {
+        PhaseScope timing(*this, STAT_IR);
+        buildIr();
+        numberValues();
+        verifyIr();
+        initializeStores();
+        evaluatePrefix();
+    }
+    {
+        PhaseScope timing(*this, STAT_CODEGEN);
+        lowerIr();
+        code("end", ".");       // emit epilogue + storage
+    }
+
+    PhaseScope timing(*this, STAT_OUTPUT);
+    if (!astFileName.empty()) {
+        std::ofstream astFile(astFileName.c_str());
+        if (!astFile.is_open()) {
+            processError("Unable to open AST file: " + astFileName);
+        }
+        writeAst(astFile, astRoot, 0);
+        astFile << "\n";
+    }
+
+    if (!irFileName.empty()) {
+        std::ofstream irFile(irFileName.c_str());
+        if (!irFile.is_open()) {
+            processError("Unable to open IR file: " + irFileName);
+        }
+        writeIr(irFile);
+    }
+
+    if (!layoutFileName.empty()) {
+        std::ofstream layoutFile(layoutFileName.c_str());
+        if (!layoutFile.is_open()) {
+            processError("Unable to open layout file: " + layoutFileName);
+        }
+        writeLayout(layoutFile);
+    }
 }
 
 void Compiler::constStmts(){    // stage 0, prod 6
+    TraceScope span(*this, __func__);
     // On entry token is identifier for the const declaration
     std::string x, y;
     storeTypes type = UNKNOWN;
@@ -375,6 +515,7 @@ void Compiler::constStmts(){    // stage 0, prod 6
 }
 
 void Compiler::varStmts(){      // stage 0, prod 7
+    TraceScope span(*this, __func__);
     // On entry token is identifier (first in a comma-separated list)
     if (!isNonKeyId(token)) {
         processError("non-keyword identifier expected");
@@ -383,7 +524,7 @@ void Compiler::varStmts(){      // stage 0, prod 7
     }
 
     // Parse identifier list and leave token at the token after the list
-    std::string idlist = ids(); // ids() will advance token appropriately
+    std::vector<std::string> names = ids(); // ids() will advance token appropriately
 
     // Expect colon
     if (token != ":") {
@@ -406,48 +547,42 @@ void Compiler::varStmts(){      // stage 0, prod 7
         token = nextToken(); // consume ';' and advance
     }
 
-    // Insert each identifier from the comma-separated list into the symbol table
-    std::vector<std::string> names = splitNames(idlist);
-    for (const auto &name : names) {
-        if (!name.empty()) {
-            insert(name, varType, VARIABLE, "", YES, 1);
-        }
-    }
+    // Insert each identifier from the list into the symbol table
+    insert(names, varType, VARIABLE, "", YES, 1);
 
     // If next token is another identifier, caller loop will continue parsing varStmts
 }
 
-string Compiler::ids(){         // stage 0, prod 8
-    // On entry token is an identifier
+vector<string> Compiler::ids(){         // stage 0, prod 8
+    TraceScope span(*this, __func__);
+    // On entry token is an identifier. The names are collected in a loop
+    // rather than one recursive call per name, so a long list costs linear
+    // time and no stack
+    std::vector<std::string> names;
     if (!isNonKeyId(token)) {
         processError("non-keyword identifier expected");
-        // try to recover: return empty and advance
-        std::string bad = token;
-        token = nextToken();
-        return bad;
+        return names;
     }
 
-    std::string tempString = token; // first identifier
-    token = nextToken();            // advance to next token after identifier
-
-    if (token == ",") {
+    while (true) {
+        names.push_back(token);
+        token = nextToken();        // advance to next token after identifier
+        if (token != ",") break;
         token = nextToken();        // advance past comma to next identifier
         if (!isNonKeyId(token)) {
             processError("non-keyword identifier expected");
-        } else {
-            // recursive call returns the rest of the list (as comma-separated string)
-            std::string rest = ids();
-            tempString = tempString + "," + rest;
+            break;
         }
     }
 
     // When returning, token is left at the token after the identifier list (either ":" or other)
-    return tempString;
+    return names;
 }
 
 //////////////////// EXPANDED IN STAGE 1
 
 void Compiler::execStmts(){     // stage 1, prod 2
+    TraceScope span(*this, __func__);
     // Parse zero or more executable statements until 'end' or EOF or '.'
     while (true) {
         // Stop if we reached end of block
@@ -477,6 +612,7 @@ void Compiler::execStmts(){     // stage 1, prod 2
 }
 
 void Compiler::execStmt(){      // stage 1, prod 3
+    TraceScope span(*this, __func__);
     // Decide which kind of statement based on current token
     if (isNonKeyId(token)) {
         assignStmt();
@@ -495,8 +631,10 @@ void Compiler::execStmt(){      // stage 1, prod 3
 }
 
 void Compiler::assignStmt(){    // stage 1, prod 4
+    TraceScope span(*this, __func__);
     // Syntax: <id> := <expression>
     std::string lhs = token;
+    uint32_t line = lineNo;
     if (!isNonKeyId(lhs)) {
         processError("assignment target must be an identifier");
         token = nextToken();
@@ -511,29 +649,26 @@ void Compiler::assignStmt(){    // stage 1, prod 4
         token = nextToken(); // consume ':=' and advance to expression
     }
 
-    // Parse RHS expression; express() will push result onto operand stack
+    // Parse RHS expression; express() leaves its tree on nodeStk
     express();
 
-    // After express, top of operand stack holds result
-    std::string rhs = popOperand();
-    if (rhs.empty()) {
+    if (nodeStk.empty()) {
         processError("missing expression in assignment");
         return;
     }
+    uint32_t rhs = nodeStk.back();
+    nodeStk.pop_back();
 
-    // Emit assignment: lhs := rhs
-    // If rhs is a temporary, we can store it directly into lhs
-    // If rhs is a literal or variable, emitAssignCode will handle it
-    emitAssignCode(rhs, lhs);
-
-    // If rhs was a temporary, free it now (value moved to lhs)
-    if (isTemporary(rhs)) freeTemp();
+    appendStmt(ast.newNode(AST_ASSIGN, lhs, line, rhs));
 
     // token is left at the token after the expression (express() leaves it there)
 }
 
 void Compiler::readStmt(){      // stage 1, prod 5
+    TraceScope span(*this, __func__);
     // Syntax: read ( id {, id} )
+    uint32_t stmt = ast.newNode(AST_READ, "read", lineNo);
+    uint32_t last = NO_NODE;
     token = nextToken(); // consume 'read' and advance to '(' or identifier
 
     if (token != "(") {
@@ -551,8 +686,11 @@ void Compiler::readStmt(){      // stage 1, prod 5
             token = nextToken();
             if (token == ")") break;
         } else {
-            // Emit read code for this identifier
-            emitReadCode(token);
+            // Link this identifier into the statement's target list
+            uint32_t target = ast.newNode(AST_IDENT, token, lineNo);
+            if (last == NO_NODE) ast.at(stmt).left = target;
+            else ast.at(last).next = target;
+            last = target;
             token = nextToken(); // consume identifier
         }
 
@@ -568,10 +706,15 @@ void Compiler::readStmt(){      // stage 1, prod 5
     } else {
         token = nextToken(); // consume ')'
     }
+
+    appendStmt(stmt);
 }
 
 void Compiler::writeStmt(){     // stage 1, prod 7
+    TraceScope span(*this, __func__);
     // Syntax: write ( <expression> {, <expression>} )
+    uint32_t stmt = ast.newNode(AST_WRITE, "write", lineNo);
+    uint32_t last = NO_NODE;
     token = nextToken(); // consume 'write' and advance to '('
 
     if (token != "(") {
@@ -583,14 +726,16 @@ void Compiler::writeStmt(){     // stage 1, prod 7
 
     // One or more expressions separated by commas
     while (true) {
-        // Parse expression and emit write for its result
+        // Parse expression and link it into the statement's operand list
         express();
-        std::string val = popOperand();
-        if (val.empty()) {
+        if (nodeStk.empty()) {
             processError("missing expression in write");
         } else {
-            emitWriteCode(val);
-            if (isTemporary(val)) freeTemp();
+            uint32_t val = nodeStk.back();
+            nodeStk.pop_back();
+            if (last == NO_NODE) ast.at(stmt).left = val;
+            else ast.at(last).next = val;
+            last = val;
         }
 
         // token is at next token after expression
@@ -606,187 +751,118 @@ void Compiler::writeStmt(){     // stage 1, prod 7
     } else {
         token = nextToken(); // consume ')'
     }
-}
 
-void Compiler::express(){       // stage 1, prod 9
-    // express -> term expresses
-    term();
-    expresses();
-    // After reduction, top of operand stack holds the expression result
+    appendStmt(stmt);
 }
 
-void Compiler::expresses(){     // stage 1, prod 10
-    // handles additive and logical-or operators: +, -, or
-    while (token == "+" || token == "-" || token == "or" || token == "||") {
-        std::string op = token;
-        token = nextToken(); // consume operator
-        term();              // parse right-hand term
-
-        // Pop operands: right then left
-        std::string right = popOperand();
-        std::string left  = popOperand();
-
-        if (left.empty() || right.empty()) {
-            processError("operand missing for binary operator");
-            // push back what we have and return
-            if (!left.empty()) pushOperand(left);
-            if (!right.empty()) pushOperand(right);
-            return;
-        }
-
-        // Create destination temporary and compute dest = left op right
-        std::string dest = getTemp();
-        // Copy left into dest
-        emitAssignCode(left, dest);
-
-        // Apply operator using dest as left operand
-        if (op == "+") {
-            emitAdditionCode(right, dest);
-        } else if (op == "-") {
-            emitSubtractionCode(right, dest);
-        } else if (op == "or" || op == "||") {
-            emitOrCode(right, dest);
-        } else {
-            processError("unknown additive/logical operator: " + op);
-        }
-
-        // Free temporaries used for left/right if they were temps
-        if (isTemporary(left)) freeTemp();
-        if (isTemporary(right)) freeTemp();
-
-        // Push result temp
-        pushOperand(dest);
-    }
+// How tightly a binary operator binds in express(); 0 if op is not one
+static int binaryPrecedence(const std::string &op){
+    if (op == "+" || op == "-" || op == "or" || op == "||") return 1;
+    if (op == "*" || op == "/" || op == "%" || op == "and" || op == "&&") return 2;
+    return 0;
 }
 
-void Compiler::term(){          // stage 1, prod 11
-    // term -> factor terms
-    factor();
-    terms();
+// The irOps an operator node of express() stands for
+static irOps operatorOp(const std::string &op, bool unary){
+    if (unary) return op == "-" ? IR_NEG : op == "not" ? IR_NOT : IR_ADD;
+    if (op == "+") return IR_ADD;
+    if (op == "-") return IR_SUB;
+    if (op == "*") return IR_MUL;
+    if (op == "/") return IR_DIV;
+    if (op == "%") return IR_MOD;
+    return (op == "and" || op == "&&") ? IR_AND : IR_OR;
 }
 
-void Compiler::terms(){         // stage 1, prod 12
-    // handles multiplicative and logical-and operators: *, /, %, and
-    while (token == "*" || token == "/" || token == "%" || token == "and" || token == "&&") {
-        std::string op = token;
-        token = nextToken(); // consume operator
-        factor();            // parse right-hand factor
-
-        // Pop operands: right then left
-        std::string right = popOperand();
-        std::string left  = popOperand();
-
-        if (left.empty() || right.empty()) {
-            processError("operand missing for multiplicative operator");
-            if (!left.empty()) pushOperand(left);
-            if (!right.empty()) pushOperand(right);
-            return;
-        }
-
-        // Create destination temporary and compute dest = left op right
-        std::string dest = getTemp();
-        // Copy left into dest
-        emitAssignCode(left, dest);
-
-        // Apply operator using dest as left operand
-        if (op == "*") {
-            emitMultiplicationCode(right, dest);
-        } else if (op == "/") {
-            emitDivisionCode(right, dest);
-        } else if (op == "%") {
-            emitModuloCode(right, dest);
-        } else if (op == "and" || op == "&&") {
-            emitAndCode(right, dest);
+void Compiler::express(){       // stage 1, prods 9-15
+    TraceScope span(*this, __func__);
+    // express -> term expresses, term -> factor terms, factor -> [ unary-op ]
+    // part, part -> identifier | literal | ( express ), parsed in one loop:
+    // parts go on nodeStk and pending operators on operatorStk, so nesting
+    // costs heap rather than native stack. "(" and unary operators ("u-",
+    // "u+", "unot") wait there too. Additive operators (+, -, or) bind less
+    // tightly than multiplicative ones (*, /, %, and), both associate to
+    // the left, and a unary operator applies to the one part after it.
+    const size_t base = operatorStk.size();    // entries of an enclosing statement stay
+    auto shift = [&](const std::string &op){
+        pushOperator(op);
+        operatorLines.push_back(lineNo);
+    };
+    auto reduce = [&]{                          // node for the operator on top
+        std::string op = popOperator();
+        uint32_t line = operatorLines.back();
+        operatorLines.pop_back();
+        uint32_t right = nodeStk.back();
+        nodeStk.pop_back();
+        uint32_t node;
+        if (op[0] == 'u') {
+            node = ast.newNode(AST_UNARY, op.substr(1), line, right);
+            ast.at(node).op = static_cast<uint8_t>(operatorOp(op.substr(1), true));
+            ast.at(node).need = ast.at(right).need;         // computed in place
         } else {
-            processError("unknown multiplicative/logical operator: " + op);
+            uint32_t left = nodeStk.back();
+            nodeStk.pop_back();
+            node = ast.newNode(AST_BINARY, op, line, left, right);
+            ast.at(node).op = static_cast<uint8_t>(operatorOp(op, false));
+            // Sethi-Ullman: the left operand is computed in a temp, a right
+            // leaf is used straight from memory or as an immediate, and two
+            // subtrees that need the same number of temps need one more
+            uint8_t l = ast.at(left).need;
+            uint8_t r = ast.at(right).kind == AST_BINARY || ast.at(right).kind == AST_UNARY
+                        ? ast.at(right).need : 0;
+            ast.at(node).need = l == r ? static_cast<uint8_t>(min(l + 1, 255)) : max(l, r);
         }
+        nodeStk.push_back(node);
+    };
 
-        // Free temporaries used for left/right if they were temps
-        if (isTemporary(left)) freeTemp();
-        if (isTemporary(right)) freeTemp();
-
-        // Push result temp
-        pushOperand(dest);
-    }
-}
-
-void Compiler::factor(){        // stage 1, prod 13
-    // factor -> [ unary-op ] part
-    if (token == "+" || token == "-" || token == "not") {
-        std::string unary = token;
-        token = nextToken(); // consume unary operator
-        part();              // parse the operand
-        std::string opnd = popOperand();
-        if (opnd.empty()) {
-            processError("operand expected after unary operator");
-            return;
+    while (true) {
+        // Any number of "(", with at most one unary operator before a part
+        bool unary = false;
+        while (token == "(" || (!unary && (token == "+" || token == "-" || token == "not"))) {
+            unary = (token != "(");
+            shift(unary ? "u" + token : token);
+            token = nextToken();
         }
 
-        // Create destination temp and apply unary op
-        std::string dest = getTemp();
-        // Copy operand into dest
-        emitAssignCode(opnd, dest);
-
-        if (unary == "-") {
-            emitNegationCode(dest);
-        } else if (unary == "+") {
-            // unary plus is a no-op (value already in dest)
-        } else if (unary == "not") {
-            emitNotCode(dest);
+        if (isNonKeyId(token)) {
+            // Leaf holds the external name used in emit
+            nodeStk.push_back(ast.newNode(AST_IDENT, token, lineNo));
+        } else if (isLiteral(token) || isInteger(token) || isBoolean(token)) {
+            // Leaf holds the literal spelling; pushOperand() enters it later
+            nodeStk.push_back(ast.newNode(AST_LITERAL, token, lineNo));
         } else {
-            processError("unknown unary operator: " + unary);
+            processError("literal, identifier, or '(' expected");
+            return;
         }
-
-        if (isTemporary(opnd)) freeTemp();
-        pushOperand(dest);
-    } else {
-        // No unary operator; just parse part
-        part();
-    }
-
-    // After factor, allow further factor-level processing if grammar requires
-    factors();
-}
-
-void Compiler::factors(){       // stage 1, prod 14
-    // This implementation does not define additional postfix operators,
-    // so factors is a no-op placeholder to match grammar shape.
-    // If you later add exponentiation or other postfix operators, implement here.
-    (void)0;
-}
-
-void Compiler::part(){          // stage 1, prod 15
-    // part -> identifier | literal | ( express )
-    if (token == "(") {
-        token = nextToken(); // consume '('
-        express();
-        if (token != ")") {
-            processError("')' expected");
-        } else {
+        token = nextToken(); // consume identifier or literal
+
+        // The part is complete: apply its unary operator, and close any
+        // parentheses that end here. A ")" with no "(" of this expression
+        // open belongs to the caller, as in write(a + b).
+        while (true) {
+            if (operatorStk.size() > base && operatorStk.top()[0] == 'u') reduce();
+            if (token != ")") break;
+            while (operatorStk.size() > base && operatorStk.top() != "(") reduce();
+            if (operatorStk.size() == base) break;
+            popOperator();
+            operatorLines.pop_back();
             token = nextToken(); // consume ')'
         }
-        return;
-    }
 
-    // Identifier
-    if (isNonKeyId(token)) {
-        // Push the identifier name as operand (external name used in emit)
-        pushOperand(token);
-        token = nextToken(); // consume identifier
-        return;
+        int precedence = binaryPrecedence(token);
+        if (precedence == 0) break;
+        while (operatorStk.size() > base && binaryPrecedence(operatorStk.top()) >= precedence) reduce();
+        shift(token);
+        token = nextToken(); // consume operator
     }
 
-    // Literal (integer or boolean)
-    if (isLiteral(token) || isInteger(token) || isBoolean(token)) {
-        // Push literal token directly; emit routines will accept literals
-        pushOperand(token);
-        token = nextToken(); // consume literal
-        return;
+    while (operatorStk.size() > base) {
+        if (operatorStk.top() == "(") {
+            processError("')' expected");
+            return;
+        }
+        reduce();
     }
-
-    // Unexpected token
-    processError("literal, identifier, or '(' expected");
-    token = nextToken(); // try to recover
+    // After reduction, top of nodeStk holds the expression tree
 }
 
 /* ------------------------------------------------------
@@ -852,8 +928,15 @@ bool Compiler::isLiteral(string s) const {      // is s a lit?
     ------------------------------------------------------ */
 
 void Compiler::insert(string externalName, storeTypes inType, modes inMode, string inValue, allocation inAlloc, int inUnits){
-    std::vector<std::string> names = splitNames(externalName);
+    // A single name needs no splitting; most calls enter one literal or temp
+    if (externalName.find_first_of(", \t\n") == std::string::npos && !externalName.empty()) {
+        insert(std::vector<std::string>(1, externalName), inType, inMode, inValue, inAlloc, inUnits);
+    } else {
+        insert(splitNames(externalName), inType, inMode, inValue, inAlloc, inUnits);
+    }
+}
 
+void Compiler::insert(const vector<string> &names, storeTypes inType, modes inMode, string inValue, allocation inAlloc, int inUnits){
     for(const std::string& name : names){
         if (name.empty()) {
             processError("empty identifier in insert()");
@@ -861,7 +944,7 @@ void Compiler::insert(string externalName, storeTypes inType, modes inMode, stri
         }
         if(symbolTable.count(name)){
             processError("symbol " + name + " is multiply defined");
-        } else if (isKeyword(name)) {
+        } else if (isKeyword(name) && !isBoolean(name)) {   // true/false enter as literals
             processError("illegal use of keyword: " + name);
         } else {
             std::string internalName;
@@ -870,6 +953,9 @@ void Compiler::insert(string externalName, storeTypes inType, modes inMode, stri
             } else {
                 internalName = genInternalName(inType);
             }
+            if (packBooleans && inMode == VARIABLE && inType == BOOLEAN && !isTemporary(internalName)) {
+                byteStorage.insert(internalName);
+            }
             // Use the SymbolTableEntry constructor and insert into map
             symbolTable.emplace(name, SymbolTableEntry(internalName, inType, inMode, inValue, inAlloc, inUnits));
         }
@@ -911,52 +997,54 @@ string Compiler::whichValue(string name){        // which value does name have?
 
 //////////////////// EXPANDED IN STAGE 1
 
+// Spellings of irOps, as accepted by code() and printed in ir.txt
+static const char *const irOpNames[] = {"+", "-", "*", "div", "mod", "and", "or",
+    "==", "!=", "<", "<=", ">", ">=", "neg", "not", "store", "read", "write",
+    "iffalse", "iftrue", "label", "phi"};
+
 void Compiler::code(string op, string operand1, string operand2){       // generates the code
     if(op == "program"){
         emitPrologue(operand1);
     } else if(op == "end"){
         emitEpilogue();
-    } else if(op == "read"){
-        emitReadCode(operand1);
-    } else if(op == "write"){
-        emitWriteCode(operand1);
-    } else if(op == "+"){       // binary +
-        emitAdditionCode(operand1, operand2);
-    } else if(op == "-"){       // binary -
-        emitSubtractionCode(operand1, operand2);
-    } else if(op == "neg"){     // unary -
-        emitNegationCode(operand1, operand2);
-    } else if(op == "not"){
-        emitNotCode(operand1, operand2);
-    } else if(op == "*"){
-        emitMultiplicationCode(operand1, operand2);
-    } else if(op == "div" || op == "/"){
-        emitDivisionCode(operand1, operand2);
-    } else if(op == "mod" || op == "%"){
-        emitModuloCode(operand1, operand2);
-    } else if(op == "and" || op == "&&"){
-        emitAndCode(operand1, operand2);
-    } else if(op == "or" || op == "||"){
-        emitOrCode(operand1, operand2);
-    } else if(op == "=="){
-        emitEqualityCode(operand1, operand2);
-    } else if(op == "!="){
-        emitInequalityCode(operand1, operand2);
-    } else if(op == "<"){
-        emitLessThanCode(operand1, operand2);
-    } else if(op == "<="){
-        emitLessThanOrEqualToCode(operand1, operand2);
-    } else if(op == ">"){
-        emitGreaterThanCode(operand1, operand2);
-    } else if(op == ">="){
-        emitGreaterThanOrEqualToCode(operand1, operand2);
-    } else if(op == ":="){
-        emitAssignCode(operand1, operand2);
+    } else if(op == "/" || op == "%" || op == "&&" || op == "||" || op == ":="){
+        code(op == "/" ? IR_DIV : op == "%" ? IR_MOD : op == "&&" ? IR_AND
+             : op == "||" ? IR_OR : IR_STORE, operand1, operand2);
     } else {
+        for (size_t k = 0; k < sizeof irOpNames / sizeof irOpNames[0]; ++k) {
+            if (op == irOpNames[k]) {
+                code(static_cast<irOps>(k), operand1, operand2);
+                return;
+            }
+        }
         processError("compiler error: illegal arguments to code(): " + op);
     }
 }
 
+void Compiler::code(irOps op, string operand1, string operand2){        // generates the code for op
+    typedef void (Compiler::*Emitter)(string, string);
+    // Indexed by irOps; labels and phis are placed by lowerIr() itself
+    static constexpr Emitter emitters[] = {
+        &Compiler::emitAdditionCode, &Compiler::emitSubtractionCode,
+        &Compiler::emitMultiplicationCode, &Compiler::emitDivisionCode,
+        &Compiler::emitModuloCode, &Compiler::emitAndCode, &Compiler::emitOrCode,
+        &Compiler::emitEqualityCode, &Compiler::emitInequalityCode,
+        &Compiler::emitLessThanCode, &Compiler::emitLessThanOrEqualToCode,
+        &Compiler::emitGreaterThanCode, &Compiler::emitGreaterThanOrEqualToCode,
+        &Compiler::emitNegationCode, &Compiler::emitNotCode, &Compiler::emitAssignCode,
+        &Compiler::emitReadCode, &Compiler::emitWriteCode,
+        &Compiler::emitJumpIfFalseCode, &Compiler::emitJumpIfTrueCode,
+        nullptr, nullptr,
+    };
+    static_assert(sizeof emitters / sizeof emitters[0] == IR_PHI + 1, "one emitter per irOps");
+    if (op > IR_PHI || !emitters[op]) {
+        processError(std::string("compiler error: illegal arguments to code(): ") +
+                     (op > IR_PHI ? "?" : irOpNames[op]));
+        return;
+    }
+    (this->*emitters[op])(operand1, operand2);
+}
+
 // Stack helpers and emit functions
 
 void Compiler::pushOperator(string name){         // push name onto operatorStk
@@ -974,6 +1062,11 @@ string Compiler::popOperator(){   // pop name from operatorStk
 }
 
 void Compiler::pushOperand(string name){          // push name onto operandStk
+    enterLiteral(name);
+    operandStk.push(name);
+}
+
+void Compiler::enterLiteral(string name){
     // If name is a literal and not already in the symbol table, create an entry
     if (isLiteral(name) || isInteger(name) || isBoolean(name)) {
         if (symbolTable.count(name) == 0) {
@@ -983,7 +1076,6 @@ void Compiler::pushOperand(string name){          // push name onto operandStk
             insert(name, t, CONSTANT, name, YES, 1);
         }
     }
-    operandStk.push(name);
 }
 
 string Compiler::popOperand(){    // pop name from operandStk
@@ -1002,6 +1094,17 @@ string Compiler::popOperand(){    // pop name from operandStk
 
 void Compiler::emit(string label, string instruction, string operands, string comment)
 {
+    if (label == "SECTION") {
+        stats.inText = (instruction == ".text");
+    } else if (stats.inText && !instruction.empty() && label != "global") {
+        ++stats.instructions;
+    }
+    if (elfOutput) {
+        if (!elf.assemble(label, instruction, operands)) {
+            processError("compiler error: cannot encode " + label + " " + instruction + " " + operands);
+        }
+        return;
+    }
     objectFile << std::left                      // required
                << std::setw(8)  << label        // label width 8
                << std::setw(8)  << instruction  // instruction width 8
@@ -1013,37 +1116,82 @@ void Compiler::emit(string label, string instruction, string operands, string co
 void Compiler::emitPrologue(string progName, string operand2)
 {
     std::string timeStr = getTime();
-    objectFile << "; SERENA REESE, AMIRAN FIELDS\t\t" << timeStr << "\n";
+    if (!elfOutput) {
+        objectFile << "; SERENA REESE, AMIRAN FIELDS\t\t" << timeStr << "\n";
+
+        // Include directives
+        if (!pascalliteRuntime()) {
+            objectFile << "%INCLUDE \"Along32.inc\"\n";
+            objectFile << "%INCLUDE \"Macros_Along.inc\"\n";
+        }
 
-    // Include directives
-    objectFile << "%INCLUDE \"Along32.inc\"\n";
-    objectFile << "%INCLUDE \"Macros_Along.inc\"\n";
+        objectFile << "\n"; // blank line
+    }
 
-    objectFile << "\n"; // blank line
+    if (target64) {
+        emit("BITS", "64");
+        emit("default", "rel", "", "; [name] operands are RIP-relative");
+    }
+    if (pascalliteRuntime()) {
+        emit("extern", "ReadInt");
+        emit("extern", "WriteInt");
+        emit("extern", "Crlf");
+        emit("extern", "ReadInts", "", "; ecx values to/from the dwords at esi");
+        emit("extern", "WriteInts");
+        emit("extern", "WriteString", "", "; NUL-terminated string at edx");
+        emit("extern", "Exit", "", "; flushes the output buffer");
+        if (!elfOutput) objectFile << "\n";
+    }
 
     emit("SECTION", ".text");
     emit("global", "_start", "", "; program " + progName);
 
-    objectFile << "\n"; // another blank line
+    if (!elfOutput) objectFile << "\n"; // another blank line
 
     emit("_start:");
 }
 
 void Compiler::emitEpilogue(string operand1, string operand2){
-    emit("", "Exit", "{0}");
-    objectFile << "\n"; // next blank line
+    if (runProgram) {
+        emit("", "ret", "", "; back to stage1 --run");
+    } else if (pascalliteRuntime()) {
+        emit("", "call", "Exit", "; flush output, status 0");
+    } else {
+        emit("", "Exit", "{0}");
+    }
+    if (!elfOutput) objectFile << "\n"; // next blank line
     emitStorage();
+    if (elfOutput && !runProgram) {
+        PhaseScope timing(*this, STAT_OUTPUT);
+        elf.write(objectFile);
+    }
 }
 
 void Compiler::emitStorage(){
-    emit("SECTION", ".data");
-    // Iterate using const auto& pair : symbolTable
-
+    TraceScope span(*this, __func__);
+    PhaseScope timing(*this, STAT_STORAGE);
+    // Storage is laid out most referenced first, so the names the code uses
+    // most share the first 64-byte cache lines of each section instead of
+    // being spread over it in symbol table order (ties keep that order).
+    // Names the code never refers to as [name] get no storage: unused
+    // consts and variables, constants only used as immediates, and temps
+    // kept in registers.
+    static const size_t NO_ITEM = static_cast<size_t>(-1);
+    std::vector<StorageItem> data, bss;
+    std::vector<std::string> values;            // dd/db operand for each of data
     for(const auto& pair : symbolTable){
         const std::string& name = pair.first;
         const SymbolTableEntry& entry = pair.second;
+        auto used = references.find(entry.getInternalName());
 
-        if (entry.getAlloc() == YES && entry.getMode() == CONSTANT){
+        if (entry.getAlloc() != YES || used == references.end()) {
+            continue;
+        }
+        StorageItem item = {"", entry.getInternalName(), name, 0,
+                            static_cast<uint32_t>(byteStorage.count(entry.getInternalName())
+                                                  ? entry.getUnits() : 4 * entry.getUnits()),
+                            used->second};
+        if (entry.getMode() == CONSTANT){
             std::string value = entry.getValue();
 
             // Convert boolean constants
@@ -1054,27 +1202,147 @@ void Compiler::emitStorage(){
             else if (value.empty())
                 value = "0";  // fallback
 
-            emit(entry.getInternalName(), "dd", value, "; " + name);
+            item.section = ".data";
+            data.push_back(item);
+            values.push_back(value);
+        } else if (initialValues.count(name)) {
+            item.section = ".data";
+            item.name += ", set at compile time";
+            data.push_back(item);
+            values.push_back(std::to_string(initialValues.at(name)));
+        } else {
+            item.section = ".bss";
+            bss.push_back(item);
         }
     }
+    if (ioArgs > 0) {
+        StorageItem args = {".bss", "ARGS", "ReadInts/WriteInts values", 0, 4 * ioArgs, references["ARGS"]};
+        bss.push_back(args);
+    }
+    auto hottestFirst = [](const std::vector<StorageItem> &items) {
+        std::vector<size_t> order(items.size());
+        for (size_t k = 0; k < order.size(); ++k) order[k] = k;
+        std::stable_sort(order.begin(), order.end(),
+                         [&](size_t x, size_t y) { return items[x].refs > items[y].refs; });
+        // Dwords stay 4-byte aligned: when one would start off a boundary,
+        // the next packed booleans in line fill the gap (padding, NO_ITEM,
+        // once there are none left)
+        std::vector<size_t> placed;
+        std::vector<bool> done(items.size(), false);
+        uint32_t offset = 0;
+        size_t next = 0;
+        for (size_t pos = 0; pos < order.size(); ++pos) {
+            size_t k = order[pos];
+            if (done[k]) continue;
+            while (items[k].bytes % 4 == 0 && offset % 4 != 0) {
+                next = std::max(next, pos + 1);
+                while (next < order.size() && (done[order[next]] || items[order[next]].bytes != 1)) ++next;
+                placed.push_back(next < order.size() ? order[next] : NO_ITEM);
+                if (next < order.size()) done[order[next]] = true;
+                ++offset;
+            }
+            placed.push_back(k);
+            done[k] = true;
+            offset += items[k].bytes;
+        }
+        return placed;
+    };
+
+    layout.clear();
+    uint32_t offset = 0;
+    emit("SECTION", ".data", "align=64");
+    for (size_t k : hottestFirst(data)) {
+        if (k == NO_ITEM) {
+            emit("", "db", "0", "; padding");
+            ++offset;
+            continue;
+        }
+        data[k].offset = offset;
+        offset += data[k].bytes;
+        emit(data[k].label, data[k].bytes == 1 ? "db" : "dd", values[k], "; " + data[k].name);
+        layout.push_back(data[k]);
+    }
+    for (size_t k = 0; k < writeStrings.size(); ++k) {
+        // '+5', 10, '-1', 10, 0 -- sixteen lines of output per db
+        std::string label = "S" + std::to_string(k), items, line;
+        int lines = 0;
+        for (char c : writeStrings[k]) {
+            if (c != '\n') {
+                line += c;
+                continue;
+            }
+            items += (items.empty() ? "'" : ", '") + line + "', 10";
+            line.clear();
+            if (++lines % 16 == 0) {
+                emit(label, "db", items, label.empty() ? "" : "; constant output");
+                label.clear();
+                items.clear();
+            }
+        }
+        emit(label, "db", items.empty() ? "0" : items + ", 0", label.empty() ? "" : "; constant output");
+        StorageItem text = {".data", "S" + std::to_string(k), "constant output", offset,
+                            static_cast<uint32_t>(writeStrings[k].size() + 1), 0};
+        offset += text.bytes;
+        layout.push_back(text);
+    }
 
-    objectFile << "\n"; // blank line before next section
-
-    emit("SECTION", ".bss");
-
-    for(const auto& pair : symbolTable){
-        const std::string& name = pair.first;
-        const SymbolTableEntry& entry = pair.second;
+    if (!elfOutput) objectFile << "\n"; // blank line before next section
 
-        if(entry.getAlloc() == YES && entry.getMode() == VARIABLE){
-            emit(entry.getInternalName(), "resd", std::to_string(entry.getUnits()), "; " + name);
+    offset = 0;
+    emit("SECTION", ".bss", "align=64");
+    for (size_t k : hottestFirst(bss)) {
+        if (k == NO_ITEM) {
+            emit("", "resb", "1", "; padding");
+            ++offset;
+            continue;
         }
+        bss[k].offset = offset;
+        offset += bss[k].bytes;
+        if (bss[k].bytes == 1) emit(bss[k].label, "resb", "1", "; " + bss[k].name);
+        else emit(bss[k].label, "resd", std::to_string(bss[k].bytes / 4), "; " + bss[k].name);
+        layout.push_back(bss[k]);
+    }
+}
+
+string Compiler::location(string internalName, bool sized){
+    // x86-64 keeps the first eight temps in r8d-r15d, which nothing else uses
+    if (target64 && isTemporary(internalName)) {
+        int n = std::atoi(internalName.c_str() + 1);
+        if (n < 8) return "r" + std::to_string(n + 8) + "d";
     }
+    // Note the storage the code uses; emitStorage() leaves out the rest
+    ++references[internalName];
+    if (byteStorage.count(internalName)) return "byte [" + internalName + "]";
+    return (sized ? "dword [" : "[") + internalName + "]";
+}
+
+string Compiler::loadOp(string internalName) const{
+    // A packed boolean is 0 or -1 in one byte; sign extension restores the dword
+    return byteStorage.count(internalName) ? "movsx" : "mov";
+}
+
+string Compiler::storeOperands(string internalName){
+    return location(internalName) + (byteStorage.count(internalName) ? ", al" : ", eax");
+}
+
+string Compiler::sourceOperand(string internalName){
+    // and/or/cmp take a dword operand, so a packed boolean goes through edx,
+    // which only idiv otherwise uses
+    if (!byteStorage.count(internalName)) return location(internalName);
+    emit("", "movsx", "edx, " + location(internalName), "; widen " + internalName);
+    return "edx";
+}
+
+bool Compiler::pascalliteRuntime() const{
+    // x86-64 code always uses runtime/pascallite.c (or --run's copy of it);
+    // i386 code uses Along32 unless --runtime=pascallite
+    return target64 || ownRuntime;
 }
 
 //////////////////// EXPANDED DURING STAGE 1
 
 void Compiler::emitReadCode(string operand, string /*operand2*/){
+    TraceScope span(*this, __func__);
     // Expect operand to be a single identifier (readStmt already handles lists)
     std::string name = operand;
 
@@ -1107,7 +1375,7 @@ void Compiler::emitReadCode(string operand, string /*operand2*/){
     emit("", "call", "ReadInt", "; read int; value placed in eax");
 
     // Store eax into the variable's storage (use internal name)
-    emit("", "mov", "[" + entry.getInternalName() + "], eax", "; store eax at " + name);
+    emit("", "mov", storeOperands(entry.getInternalName()), "; store eax at " + name);
 
     // Track that A register (eax) no longer holds a useful named value;
     // but per the spec we set contentsOfAReg to the variable that now contains the value
@@ -1115,6 +1383,7 @@ void Compiler::emitReadCode(string operand, string /*operand2*/){
 }
 
 void Compiler::emitWriteCode(string operand, string /*operand2*/){
+    TraceScope span(*this, __func__);
     // Expect operand to be a single operand (identifier, literal, or temp)
     std::string name = operand;
 
@@ -1139,7 +1408,7 @@ void Compiler::emitWriteCode(string operand, string /*operand2*/){
     // Ensure the value is in A (eax). If not, load it.
     if (contentsOfAReg != name) {
         // Load the value into eax from the symbol's internal storage
-        emit("", "mov", "eax, [" + entry.getInternalName() + "]", "; load " + name + " into eax");
+        emit("", loadOp(entry.getInternalName()), "eax, " + location(entry.getInternalName()), "; load " + name + " into eax");
         contentsOfAReg = name;
     }
 
@@ -1153,7 +1422,254 @@ void Compiler::emitWriteCode(string operand, string /*operand2*/){
     }
 }
 
+static const size_t MAX_IO_ARGS = 32; // values per ReadInts/WriteInts call
+
+static std::string writeIntText(int32_t v){
+    // What WriteInt and Crlf print for v
+    return (v < 0 ? "-" : "+") + std::to_string(v < 0 ? -static_cast<int64_t>(v) : v) + "\n";
+}
+
+void Compiler::emitReadListCode(const vector<string> &operands){
+    TraceScope span(*this, __func__);
+    // With the shipped runtime, ReadInts reads up to MAX_IO_ARGS integers
+    // into the dwords at esi (rsi), here ARGS; they are then copied to the
+    // variables in order. Along32 has only ReadInt.
+    for (size_t from = 0; from < operands.size(); from += MAX_IO_ARGS) {
+        size_t count = std::min(MAX_IO_ARGS, operands.size() - from);
+        if (!pascalliteRuntime() || count == 1) {
+            for (size_t k = from; k < from + count; ++k) emitReadCode(operands[k]);
+            continue;
+        }
+        // buildIr() has checked that each one is an INTEGER variable
+        emitArgsCall("ReadInts", count, "; read " + std::to_string(count) + " ints into ARGS");
+        for (size_t k = 0; k < count; ++k) {
+            const std::string &name = operands[from + k];
+            emit("", "mov", "eax, " + argsLocation(k), "; load input " + std::to_string(k + 1));
+            emit("", "mov", storeOperands(symbolTable.at(name).getInternalName()),
+                 "; store eax at " + name);
+        }
+        contentsOfAReg = operands[from + count - 1];
+    }
+}
+
+void Compiler::emitWriteListCode(const vector<string> &operands){
+    TraceScope span(*this, __func__);
+    // Literals (named constants and constant expressions are literals by
+    // now) are formatted here, and each run of them is printed by a single
+    // WriteString. The other values go to WriteInts, up to MAX_IO_ARGS at a
+    // time, with the shipped runtime, or to WriteInt and Crlf with Along32.
+    size_t k = 0;
+    while (k < operands.size()) {
+        size_t end = k;
+        if (isLiteral(operands[k])) {
+            std::string text;
+            for (; end < operands.size() && isLiteral(operands[end]); ++end) {
+                text += writeIntText(constValue(operands[end]));
+            }
+            emitWriteStringCode(text);
+            k = end;
+            continue;
+        }
+        while (end < operands.size() && end - k < MAX_IO_ARGS && !isLiteral(operands[end])) ++end;
+        if (!pascalliteRuntime() || end - k == 1) {
+            for (; k < end; ++k) emitWriteCode(operands[k]);
+            continue;
+        }
+        for (size_t j = k; j < end; ++j) {
+            // buildIr() has checked the types
+            const std::string &name = operands[j];
+            const SymbolTableEntry &entry = symbolTable.at(name);
+            if (contentsOfAReg != name) {
+                emit("", loadOp(entry.getInternalName()), "eax, " + location(entry.getInternalName()), "; load " + name + " into eax");
+                contentsOfAReg = name;
+            }
+            emit("", "mov", argsLocation(j - k) + ", eax", "; output " + std::to_string(j - k + 1)
+                 + " is " + name);
+        }
+        emitArgsCall("WriteInts", end - k, "; write " + std::to_string(end - k) + " values from ARGS");
+        k = end;
+    }
+}
+
+void Compiler::emitWriteStringCode(string text){
+    TraceScope span(*this, __func__);
+    // WriteString prints the NUL-terminated string at edx (rdx); equal
+    // texts share one string in .data
+    auto found = writeStringIndex.find(text);
+    if (found == writeStringIndex.end()) {
+        found = writeStringIndex.emplace(text, static_cast<uint32_t>(writeStrings.size())).first;
+        writeStrings.push_back(text);
+    }
+    std::string label = "S" + std::to_string(found->second);
+    std::string shown = text;
+    std::replace(shown.begin(), shown.end(), '\n', ' ');
+    if (target64) {
+        emit("", "lea", "rdx, [" + label + "]");
+    } else {
+        emit("", "mov", "edx, " + label);
+    }
+    emit("", "call", "WriteString", "; write " + trim(shown) + " (one per line)");
+}
+
+void Compiler::emitArgsCall(string routine, size_t count, string comment){
+    // esi (rsi) = ARGS, ecx = count; the runtime preserves every register
+    if (target64) {
+        emit("", "lea", "rsi, [ARGS]");
+        ++references["ARGS"];
+    } else {
+        emit("", "mov", "esi, ARGS");
+    }
+    emit("", "mov", "ecx, " + std::to_string(count));
+    emit("", "call", routine, comment);
+    ioArgs = std::max(ioArgs, static_cast<uint>(count));
+}
+
+string Compiler::argsLocation(size_t k){
+    ++references["ARGS"];
+    return k == 0 ? "[ARGS]" : "[ARGS+" + std::to_string(4 * k) + "]";
+}
+
+// Instruction selection
+
+// What each insnForms costs: its length as ElfObject encodes it with eax and
+// a [name] operand, and its latency in cycles on a recent x86 core. A
+// sequence's cost is its total latency, then its total length
+static const struct
+{
+    uint8_t bytes;
+    uint8_t cycles;
+} formCosts[] = {
+    {2, 0},     // xor eax, eax: a zeroing idiom, no dependency on eax
+    {5, 1},     // mov eax, imm32
+    {6, 4},     // mov eax, [name]
+    {6, 1},     // mov [name], eax
+    {2, 1},     // add eax, eax; neg eax; test eax, eax
+    {3, 1},     // add eax, imm8
+    {6, 1},     // add eax, imm32
+    {7, 6},     // add dword [name], imm8: load, add and store
+    {10, 6},    // add dword [name], imm32
+    {3, 3},     // imul eax, imm8
+    {6, 3},     // imul eax, imm32
+    {3, 1},     // shl eax, imm8
+    {3, 1},     // lea eax, [eax+eax*s]
+    {7, 1},     // lea eax, [eax*s+disp32]
+};
+static_assert(sizeof(formCosts) / sizeof(formCosts[0]) == FORM_LEA_DISP32 + 1, "a cost for every insnForms");
+
+static uint32_t sequenceCost(const vector<AsmLine> &lines){
+    uint32_t cycles = 0, bytes = 0;
+    for (const AsmLine &line : lines) {
+        cycles += formCosts[line.form].cycles;
+        bytes += formCosts[line.form].bytes;
+    }
+    return cycles << 16 | bytes;
+}
+
+// The first of the lowest cost
+static const vector<AsmLine> &cheapest(const vector<vector<AsmLine>> &candidates){
+    size_t best = 0;
+    for (size_t k = 1; k < candidates.size(); ++k) {
+        if (sequenceCost(candidates[k]) < sequenceCost(candidates[best])) best = k;
+    }
+    return candidates[best];
+}
+
+static bool fitsByte(int32_t v){
+    return v >= -128 && v <= 127;
+}
+
+static int32_t negated(int32_t v){                 // with the wraparound of neg
+    return static_cast<int32_t>(0u - static_cast<uint32_t>(v));
+}
+
+// Ways to load an immediate into eax
+static vector<vector<AsmLine>> loadCandidates(int32_t value, const string &comment){
+    vector<vector<AsmLine>> c = {{{FORM_MOV_IMM, "mov", "eax, " + std::to_string(value), comment}}};
+    if (value == 0) c.push_back({{FORM_XOR_ZERO, "xor", "eax, eax", comment}});
+    return c;
+}
+
+// Ways to add addend to target, eax or a dword in memory (named subject in
+// the comment): add, or sub of the negated value, which may fit a byte
+static vector<vector<AsmLine>> addCandidates(const string &target, int32_t addend, const string &subject = "eax"){
+    const bool memory = target != "eax";
+    auto form = [memory](int32_t v) {
+        return memory ? (fitsByte(v) ? FORM_RMW_IMM8 : FORM_RMW_IMM32) : (fitsByte(v) ? FORM_ALU_IMM8 : FORM_ALU_IMM32);
+    };
+    const string effect = "; " + subject + " ";
+    vector<vector<AsmLine>> c;
+    if (addend == 0) {
+        c.push_back({});
+        return c;
+    }
+    // sub is listed first for a negative addend, so x - 5 stays sub eax, 5
+    int32_t minus = negated(addend);
+    if (addend != minus && addend < 0) {
+        c.push_back({{form(minus), "sub", target + ", " + std::to_string(minus), effect + "-= " + std::to_string(minus)}});
+    }
+    c.push_back({{form(addend), "add", target + ", " + std::to_string(addend), effect + "+= " + std::to_string(addend)}});
+    if (addend != minus && addend > 0) {
+        c.push_back({{form(minus), "sub", target + ", " + std::to_string(minus), effect + "-= " + std::to_string(minus)}});
+    }
+    return c;
+}
+
+// Ways to compute eax = eax * multiplier + addend: imul, neg, add eax, eax,
+// shl and lea for the multiplier, each followed by the addend, and lea
+// eax, [eax*s+addend] for both at once. In 64-bit code lea addresses with rax
+static vector<vector<AsmLine>> affineCandidates(int32_t multiplier, int32_t addend, bool wide){
+    const string acc = wide ? "rax" : "eax";
+    const string m = std::to_string(multiplier);
+    if (multiplier == 0) return loadCandidates(addend, "; eax = " + std::to_string(addend));
+
+    vector<vector<AsmLine>> products;
+    if (multiplier == 1) products.push_back({});
+    if (multiplier == -1) products.push_back({{FORM_REG, "neg", "eax", "; eax *= -1"}});
+    // multiplier = s * 2^k with s one of 1, 3, 5, 9: lea for s, then add eax,
+    // eax or shl for 2^k
+    uint32_t k = 0, s = static_cast<uint32_t>(multiplier);
+    while (multiplier > 1 && s % 2 == 0) {
+        s /= 2;
+        ++k;
+    }
+    if (multiplier > 1 && (s == 1 || s == 3 || s == 5 || s == 9)) {
+        vector<AsmLine> lines;
+        if (s > 1) {
+            lines.push_back({FORM_LEA, "lea", "eax, [" + acc + "+" + acc + "*" + std::to_string(s - 1) + "]",
+                             "; eax *= " + std::to_string(s)});
+        }
+        if (k == 1) {
+            lines.push_back({FORM_REG, "add", "eax, eax", "; eax *= 2"});
+        } else if (k > 1) {
+            lines.push_back({FORM_SHIFT, "shl", "eax, " + std::to_string(k), "; eax *= " + std::to_string(1u << k)});
+        }
+        products.push_back(lines);
+    }
+    if (multiplier != 1) {
+        products.push_back({{fitsByte(multiplier) ? FORM_IMUL_IMM8 : FORM_IMUL_IMM32, "imul", "eax, " + m, "; eax *= " + m}});
+    }
+
+    vector<vector<AsmLine>> c;
+    for (const vector<AsmLine> &sums : addCandidates("eax", addend)) {
+        for (const vector<AsmLine> &product : products) {
+            c.push_back(product);
+            c.back().insert(c.back().end(), sums.begin(), sums.end());
+        }
+    }
+    if (addend != 0 && (multiplier == 2 || multiplier == 4 || multiplier == 8)) {
+        string d = (addend < 0 ? "" : "+") + std::to_string(addend);
+        c.push_back({{FORM_LEA_DISP32, "lea", "eax, [" + acc + "*" + m + d + "]",
+                      "; eax = eax * " + m + " " + d.substr(0, 1) + " " + d.substr(1)}});
+    }
+    return c;
+}
+
+void Compiler::emitCheapest(const vector<vector<AsmLine>> &candidates){
+    for (const AsmLine &line : cheapest(candidates)) emit("", line.instruction, line.operands, line.comment);
+}
+
 void Compiler::emitAssignCode(string operand1, string operand2){        // op2 = op1
+    TraceScope span(*this, __func__);
     if (operand1.empty() || operand2.empty()) {
         processError("internal error: empty operand in emitAssignCode");
         return;
@@ -1200,32 +1716,61 @@ void Compiler::emitAssignCode(string operand1, string operand2){        // op2 =
     if (contentsOfAReg != operand1) {
         // If operand1 is a literal constant, load immediate into eax
         if (srcEntry.getMode() == CONSTANT && isInteger(srcEntry.getValue())) {
-            // Use immediate move for integer literal
-            emit("", "mov", "eax, " + srcEntry.getValue(), "; load immediate literal " + srcEntry.getValue());
+            // Use immediate move for integer literal (xor eax, eax for 0)
+            emitCheapest(loadCandidates(constValue(srcEntry.getValue()), "; load immediate literal " + srcEntry.getValue()));
         } else {
             // Load from memory (internal name)
-            emit("", "mov", "eax, [" + srcEntry.getInternalName() + "]", "; load " + operand1 + " into eax");
+            emit("", loadOp(srcEntry.getInternalName()), "eax, " + location(srcEntry.getInternalName()), "; load " + operand1 + " into eax");
         }
     }
 
-    // Store eax into destination memory
-    emit("", "mov", "[" + destEntry.getInternalName() + "], eax", "; store eax into " + operand2);
+    // Store eax into destination memory, unless lowerIr() keeps it in eax
+    if (operand2 != elidedStore) {
+        emit("", "mov", storeOperands(destEntry.getInternalName()), "; store eax into " + operand2);
+    }
 
     // Update contentsOfAReg to reflect that eax now corresponds to the destination
     contentsOfAReg = operand2;
 
-    // If operand1 was a temporary, free it now (its value moved)
-    if (isTemporary(operand1)) freeTemp();
-
-    // Note: operand2 should never be a temporary (assignment target must be a variable)
+    // Temporaries are released by lowerIr(), which knows their lifetimes
 }
 
 // Arithmetic / logical emit implementations
 
-void Compiler::emitAdditionCode(string operand1, string operand2){      // op2 + op1
+// How each binary irOps is spelled by the emit templates below and in
+// diagnostics: the instruction, the jump a comparison takes when it holds,
+// what the instruction's comment says it does, and the operation's name
+static const struct
+{
+    const char *mnemonic;
+    const char *jump;
+    const char *effect;
+    const char *name;
+} opSpellings[] = {
+    {"add", "", "+=", "addition"},
+    {"sub", "", "-=", "subtraction"},
+    {"imul", "", "*=", "multiplication"},
+    {"idiv", "", "/=", "division"},
+    {"idiv", "", "%=", "modulo"},
+    {"and", "", "&=", "and"},
+    {"or", "", "|=", "or"},
+    {"cmp", "JE", "equal", "equality"},
+    {"cmp", "jne", "not equal", "inequality"},
+    {"cmp", "JL", "less", "less-than"},
+    {"cmp", "jle", "less or equal", "less-than-or-equal"},
+    {"cmp", "jg", "greater", "greater-than"},
+    {"CMP", "JGE", "greater or equal", "greater-than-or-equal"},
+};
+
+// op2 = op2 op op1 in eax, for the operations that are one two-operand
+// instruction: add, sub, imul on integers and and, or on booleans
+template <irOps op>
+void Compiler::emitAccumulatorCode(string operand1, string operand2){
+    const storeTypes type = (op == IR_AND || op == IR_OR) ? BOOLEAN : INTEGER;
     // operand2 is the destination (already contains left operand)
-    if (whichType(operand1) != INTEGER || whichType(operand2) != INTEGER) {
-        processError("illegal type in addition (integers required)");
+    if (whichType(operand1) != type || whichType(operand2) != type) {
+        processError(string("illegal type in ") + opSpellings[op].name +
+                     (type == INTEGER ? " (integers required)" : " (booleans required)"));
         return;
     }
 
@@ -1244,94 +1789,132 @@ void Compiler::emitAdditionCode(string operand1, string operand2){      // op2 +
     }
 
     // If A register currently holds a temporary that is neither operand1 nor operand2,
-    // spill it to memory and mark it allocated.
+    // spill it to memory and mark it allocated. A named variable in eax was
+    // stored when it was assigned, unless lowerIr() elided that store.
     if (!contentsOfAReg.empty() && contentsOfAReg != operand1 && contentsOfAReg != operand2) {
-        if (symbolTable.count(contentsOfAReg)) {
+        if (symbolTable.count(contentsOfAReg) && (isTemporary(contentsOfAReg) || contentsOfAReg == elidedStore)) {
             // store eax into that symbol's internal name
-            emit("", "mov", "[" + symbolTable.at(contentsOfAReg).getInternalName() + "], eax", "; spill A reg (" + contentsOfAReg + ")");
+            emit("", "mov", storeOperands(symbolTable.at(contentsOfAReg).getInternalName()), "; spill A reg (" + contentsOfAReg + ")");
+            ++stats.spills;
             // mark it allocated
             symbolTable.at(contentsOfAReg).setAlloc(YES);
         }
         contentsOfAReg.clear();
     }
 
+    // A constant operand of add, sub or imul is applied by the cheapest
+    // sequence for x * m + a (shl, lea, add eax, eax, ...)
+    const auto &srcEntry = symbolTable.at(operand1);
+    const bool immediate = srcEntry.getMode() == CONSTANT && isInteger(srcEntry.getValue());
+    if (immediate && (op == IR_ADD || op == IR_SUB || op == IR_MUL)) {
+        int32_t v = constValue(srcEntry.getValue());
+        emitAffineCode(operand2, op == IR_MUL ? v : 1, op == IR_ADD ? v : op == IR_SUB ? negated(v) : 0);
+        return;
+    }
+
     // Load destination (operand2) into eax if it's not already in A
+    const auto &destEntry = symbolTable.at(operand2);
     if (contentsOfAReg != operand2) {
-        const auto &destEntry = symbolTable.at(operand2);
-        emit("", "mov", "eax, [" + destEntry.getInternalName() + "]", "; load " + operand2 + " into eax");
+        emit("", loadOp(destEntry.getInternalName()), "eax, " + location(destEntry.getInternalName()), "; load " + operand2 + " into eax");
         contentsOfAReg = operand2;
     }
 
-    // Add operand1 to eax (use immediate if literal integer)
-    const auto &srcEntry = symbolTable.at(operand1);
-    if (srcEntry.getMode() == CONSTANT && isInteger(srcEntry.getValue())) {
-        emit("", "add", "eax, " + srcEntry.getValue(), "; eax += " + srcEntry.getValue());
+    // Apply operand1 to eax (use immediate if literal integer); a packed
+    // boolean is widened first. and with TRUE and or with FALSE do nothing,
+    // and with FALSE is xor eax, eax
+    const string effect = string("; eax ") + opSpellings[op].effect + " ";
+    if (immediate) {
+        int32_t v = constValue(srcEntry.getValue());
+        vector<vector<AsmLine>> candidates = {{{fitsByte(v) ? FORM_ALU_IMM8 : FORM_ALU_IMM32, opSpellings[op].mnemonic,
+                                               "eax, " + srcEntry.getValue(), effect + srcEntry.getValue()}}};
+        if (v == (op == IR_AND ? -1 : 0)) candidates.push_back({});
+        if (op == IR_AND && v == 0) candidates.push_back({{FORM_XOR_ZERO, "xor", "eax, eax", effect + "0"}});
+        emitCheapest(candidates);
     } else {
-        emit("", "add", "eax, " + srcEntry.getInternalName(), "; eax += " + operand1);
+        emit("", opSpellings[op].mnemonic, "eax, " + sourceOperand(srcEntry.getInternalName()), effect + operand1);
     }
 
     // Store result back to destination memory
-    const auto &destEntry = symbolTable.at(operand2);
-    emit("", "mov", "[" + destEntry.getInternalName() + "], eax", "; store result into " + operand2);
+    if (operand2 != elidedStore) {
+        emit("", "mov", storeOperands(destEntry.getInternalName()), "; store result into " + operand2);
+    }
 
     // Update A register tracking: now A corresponds to operand2
     contentsOfAReg = operand2;
+}
 
-    // Free any temporary used as source (operand1) if it was a temp
-    if (isTemporary(operand1)) freeTemp();
-    // operand2 is the result temp and must not be freed here
+void Compiler::emitAdditionCode(string operand1, string operand2){      // op2 + op1
+    TraceScope span(*this, __func__);
+    emitAccumulatorCode<IR_ADD>(operand1, operand2);
 }
 
 void Compiler::emitSubtractionCode(string operand1, string operand2){   // op2 - op1
-    if (whichType(operand1) != INTEGER || whichType(operand2) != INTEGER) {
-        processError("illegal type in subtraction (integers required)");
-        return;
-    }
+    TraceScope span(*this, __func__);
+    emitAccumulatorCode<IR_SUB>(operand1, operand2);
+}
 
-    if (!symbolTable.count(operand1)) {
-        if (isLiteral(operand1) || isInteger(operand1) || isBoolean(operand1))
-            insert(operand1, whichType(operand1), CONSTANT, operand1, YES, 1);
-        else {
-            processError("reference to undefined symbol: " + operand1);
-            return;
-        }
-    }
-    if (!symbolTable.count(operand2)) {
-        processError("reference to undefined symbol (destination): " + operand2);
+void Compiler::emitMultiplicationCode(string operand1, string operand2){        // op2 * op1
+    TraceScope span(*this, __func__);
+    emitAccumulatorCode<IR_MUL>(operand1, operand2);
+}
+
+void Compiler::emitAffineCode(string operand, int32_t multiplier, int32_t addend){  // op * m + a
+    TraceScope span(*this, __func__);
+    if (!symbolTable.count(operand) || whichType(operand) != INTEGER) {
+        processError("compiler error: integer operand expected in multiply-add: " + operand);
         return;
     }
 
-    if (!contentsOfAReg.empty() && contentsOfAReg != operand1 && contentsOfAReg != operand2) {
-        if (symbolTable.count(contentsOfAReg)) {
-            emit("", "mov", "[" + symbolTable.at(contentsOfAReg).getInternalName() + "], eax", "; spill A reg (" + contentsOfAReg + ")");
+    // Spill unrelated A reg content
+    if (!contentsOfAReg.empty() && contentsOfAReg != operand) {
+        if (symbolTable.count(contentsOfAReg) && (isTemporary(contentsOfAReg) || contentsOfAReg == elidedStore)) {
+            emit("", "mov", storeOperands(symbolTable.at(contentsOfAReg).getInternalName()), "; spill A reg (" + contentsOfAReg + ")");
+            ++stats.spills;
             symbolTable.at(contentsOfAReg).setAlloc(YES);
         }
         contentsOfAReg.clear();
     }
 
-    if (contentsOfAReg != operand2) {
-        const auto &destEntry = symbolTable.at(operand2);
-        emit("", "mov", "eax, [" + destEntry.getInternalName() + "]", "; load " + operand2 + " into eax");
-        contentsOfAReg = operand2;
+    const auto &entry = symbolTable.at(operand);
+    if (contentsOfAReg != operand) {
+        emit("", loadOp(entry.getInternalName()), "eax, " + location(entry.getInternalName()), "; load " + operand + " into eax");
     }
 
-    const auto &srcEntry = symbolTable.at(operand1);
-    if (srcEntry.getMode() == CONSTANT && isInteger(srcEntry.getValue())) {
-        emit("", "sub", "eax, " + srcEntry.getValue(), "; eax -= " + srcEntry.getValue());
-    } else {
-        emit("", "sub", "eax, " + srcEntry.getInternalName(), "; eax -= " + operand1);
-    }
+    emitCheapest(affineCandidates(multiplier, addend, target64));
 
-    const auto &destEntry = symbolTable.at(operand2);
-    emit("", "mov", "[" + destEntry.getInternalName() + "], eax", "; store result into " + operand2);
-    contentsOfAReg = operand2;
+    if (operand != elidedStore) {
+        emit("", "mov", storeOperands(entry.getInternalName()), "; store result into " + operand);
+    }
+    contentsOfAReg = operand;
+}
 
-    if (isTemporary(operand1)) freeTemp();
+bool Compiler::emitIncrementCode(string variable, int32_t addend){         // var += a
+    TraceScope span(*this, __func__);
+    // variable := variable + addend as add dword [variable], addend, when
+    // that costs less than loading it into eax, adding and storing it back
+    if (!symbolTable.count(variable)) return false;
+    const auto &entry = symbolTable.at(variable);
+    if (entry.getMode() != VARIABLE || entry.getDataType() != INTEGER) return false;
+
+    vector<AsmLine> throughA;
+    if (contentsOfAReg != variable) throughA.push_back({FORM_LOAD, "", "", ""});
+    const vector<vector<AsmLine>> sums = addCandidates("eax", addend);
+    throughA.insert(throughA.end(), cheapest(sums).begin(), cheapest(sums).end());
+    throughA.push_back({FORM_STORE, "", "", ""});
+    // The costs do not depend on the operand text, so the memory operand,
+    // which location() counts as a reference, is only built once chosen
+    if (sequenceCost(cheapest(addCandidates("memory", addend, variable))) > sequenceCost(throughA)) return false;
+
+    if (addend != 0) emitCheapest(addCandidates(location(entry.getInternalName(), true), addend, variable));
+    if (addend != 0 && contentsOfAReg == variable) contentsOfAReg.clear();
+    return true;
 }
 
-void Compiler::emitMultiplicationCode(string operand1, string operand2){        // op2 * op1
+void Compiler::emitDivisionCode(string operand1, string operand2){      // op2 / op1
+    TraceScope span(*this, __func__);
+    // op2 is dividend (left), operand1 is divisor (right)
     if (whichType(operand1) != INTEGER || whichType(operand2) != INTEGER) {
-        processError("illegal type in multiplication (integers required)");
+        processError("illegal type in division (integers required)");
         return;
     }
 
@@ -1344,71 +1927,24 @@ void Compiler::emitMultiplicationCode(string operand1, string operand2){
         }
     }
     if (!symbolTable.count(operand2)) {
-        processError("reference to undefined symbol (destination): " + operand2);
+        processError("reference to undefined symbol (dividend): " + operand2);
         return;
     }
 
-    if (!contentsOfAReg.empty() && contentsOfAReg != operand1 && contentsOfAReg != operand2) {
-        if (symbolTable.count(contentsOfAReg)) {
-            emit("", "mov", "[" + symbolTable.at(contentsOfAReg).getInternalName() + "], eax", "; spill A reg (" + contentsOfAReg + ")");
+    // Spill unrelated A reg content
+    if (!contentsOfAReg.empty() && contentsOfAReg != operand2 && contentsOfAReg != operand1) {
+        if (symbolTable.count(contentsOfAReg) && (isTemporary(contentsOfAReg) || contentsOfAReg == elidedStore)) {
+            emit("", "mov", storeOperands(symbolTable.at(contentsOfAReg).getInternalName()), "; spill A reg (" + contentsOfAReg + ")");
+            ++stats.spills;
             symbolTable.at(contentsOfAReg).setAlloc(YES);
         }
         contentsOfAReg.clear();
     }
 
+    // Load dividend (operand2) into eax if not already there
     if (contentsOfAReg != operand2) {
-        const auto &destEntry = symbolTable.at(operand2);
-        emit("", "mov", "eax, [" + destEntry.getInternalName() + "]", "; load " + operand2 + " into eax");
-        contentsOfAReg = operand2;
-    }
-
-    const auto &srcEntry = symbolTable.at(operand1);
-    if (srcEntry.getMode() == CONSTANT && isInteger(srcEntry.getValue())) {
-        emit("", "imul", "eax, " + srcEntry.getValue(), "; eax *= " + srcEntry.getValue());
-    } else {
-        emit("", "imul", "eax, " + srcEntry.getInternalName(), "; eax *= " + operand1);
-    }
-
-    const auto &destEntry = symbolTable.at(operand2);
-    emit("", "mov", "[" + destEntry.getInternalName() + "], eax", "; store result into " + operand2);
-    contentsOfAReg = operand2;
-
-    if (isTemporary(operand1)) freeTemp();
-}
-
-void Compiler::emitDivisionCode(string operand1, string operand2){      // op2 / op1
-    // op2 is dividend (left), operand1 is divisor (right)
-    if (whichType(operand1) != INTEGER || whichType(operand2) != INTEGER) {
-        processError("illegal type in division (integers required)");
-        return;
-    }
-
-    if (!symbolTable.count(operand1)) {
-        if (isLiteral(operand1) || isInteger(operand1) || isBoolean(operand1))
-            insert(operand1, whichType(operand1), CONSTANT, operand1, YES, 1);
-        else {
-            processError("reference to undefined symbol: " + operand1);
-            return;
-        }
-    }
-    if (!symbolTable.count(operand2)) {
-        processError("reference to undefined symbol (dividend): " + operand2);
-        return;
-    }
-
-    // Spill unrelated A reg content
-    if (!contentsOfAReg.empty() && contentsOfAReg != operand2 && contentsOfAReg != operand1) {
-        if (symbolTable.count(contentsOfAReg)) {
-            emit("", "mov", "[" + symbolTable.at(contentsOfAReg).getInternalName() + "], eax", "; spill A reg (" + contentsOfAReg + ")");
-            symbolTable.at(contentsOfAReg).setAlloc(YES);
-        }
-        contentsOfAReg.clear();
-    }
-
-    // Load dividend (operand2) into eax if not already there
-    if (contentsOfAReg != operand2) {
-        const auto &dividendEntry = symbolTable.at(operand2);
-        emit("", "mov", "eax, [" + dividendEntry.getInternalName() + "]", "; load dividend " + operand2 + " into eax");
+        const auto &dividendEntry = symbolTable.at(operand2);
+        emit("", loadOp(dividendEntry.getInternalName()), "eax, " + location(dividendEntry.getInternalName()), "; load dividend " + operand2 + " into eax");
         contentsOfAReg = operand2;
     }
 
@@ -1424,23 +1960,24 @@ void Compiler::emitDivisionCode(string operand1, string operand2){      // op2 /
         if (isInteger(immName) && !symbolTable.count(immName)) {
             insert(immName, INTEGER, CONSTANT, immName, YES, 1);
         }
-        emit("", "idiv", divisorEntry.getInternalName(), "; idiv by " + operand1);
+        emit("", "idiv", location(divisorEntry.getInternalName(), true), "; idiv by " + operand1);
     } else {
-        emit("", "idiv", divisorEntry.getInternalName(), "; idiv by " + operand1);
+        emit("", "idiv", location(divisorEntry.getInternalName(), true), "; idiv by " + operand1);
     }
 
     // After IDIV, quotient in eax. Store quotient into destination (operand2's internal name)
     const auto &destEntry = symbolTable.at(operand2);
-    emit("", "mov", "[" + destEntry.getInternalName() + "], eax", "; store quotient into " + operand2);
+    if (operand2 != elidedStore) {
+        emit("", "mov", storeOperands(destEntry.getInternalName()), "; store quotient into " + operand2);
+    }
 
     // Update A register tracking
     contentsOfAReg = operand2;
 
-    // Free temporary divisor if it was a temp
-    if (isTemporary(operand1)) freeTemp();
 }
 
 void Compiler::emitModuloCode(string operand1, string operand2){        // op2 % op1
+    TraceScope span(*this, __func__);
     // op2 is dividend, operand1 is divisor; result should be remainder
     if (whichType(operand1) != INTEGER || whichType(operand2) != INTEGER) {
         processError("illegal type in modulo (integers required)");
@@ -1461,8 +1998,9 @@ void Compiler::emitModuloCode(string operand1, string operand2){        // op2 %
     }
 
     if (!contentsOfAReg.empty() && contentsOfAReg != operand2 && contentsOfAReg != operand1) {
-        if (symbolTable.count(contentsOfAReg)) {
-            emit("", "mov", "[" + symbolTable.at(contentsOfAReg).getInternalName() + "], eax", "; spill A reg (" + contentsOfAReg + ")");
+        if (symbolTable.count(contentsOfAReg) && (isTemporary(contentsOfAReg) || contentsOfAReg == elidedStore)) {
+            emit("", "mov", storeOperands(symbolTable.at(contentsOfAReg).getInternalName()), "; spill A reg (" + contentsOfAReg + ")");
+            ++stats.spills;
             symbolTable.at(contentsOfAReg).setAlloc(YES);
         }
         contentsOfAReg.clear();
@@ -1470,26 +2008,26 @@ void Compiler::emitModuloCode(string operand1, string operand2){        // op2 %
 
     if (contentsOfAReg != operand2) {
         const auto &dividendEntry = symbolTable.at(operand2);
-        emit("", "mov", "eax, [" + dividendEntry.getInternalName() + "]", "; load dividend " + operand2 + " into eax");
+        emit("", loadOp(dividendEntry.getInternalName()), "eax, " + location(dividendEntry.getInternalName()), "; load dividend " + operand2 + " into eax");
         contentsOfAReg = operand2;
     }
 
     emit("", "cdq", "", "; sign-extend eax into edx:eax for idiv");
 
     const auto &divisorEntry = symbolTable.at(operand1);
-    emit("", "idiv", divisorEntry.getInternalName(), "; idiv by " + operand1);
+    emit("", "idiv", location(divisorEntry.getInternalName(), true), "; idiv by " + operand1);
 
     // Remainder is in edx; store edx into destination
     const auto &destEntry = symbolTable.at(operand2);
-    emit("", "mov", "[" + destEntry.getInternalName() + "], edx", "; store remainder into " + operand2);
+    emit("", "mov", location(destEntry.getInternalName()) + ", edx", "; store remainder into " + operand2);
 
     // A register no longer corresponds to destination (eax holds quotient)
     contentsOfAReg.clear();
 
-    if (isTemporary(operand1)) freeTemp();
 }
 
 void Compiler::emitNegationCode(string operand1, string /*operand2*/){      // -op1 (operand1 is destination temp)
+    TraceScope span(*this, __func__);
     // operand1 is expected to be the destination (temp) that already contains the operand value
     if (!symbolTable.count(operand1)) {
         processError("reference to undefined symbol in negation: " + operand1);
@@ -1502,18 +2040,21 @@ void Compiler::emitNegationCode(string operand1, string /*operand2*/){      // -
 
     // Ensure value is in eax
     if (contentsOfAReg != operand1) {
-        emit("", "mov", "eax, [" + symbolTable.at(operand1).getInternalName() + "]", "; load " + operand1 + " into eax for negation");
+        emit("", loadOp(symbolTable.at(operand1).getInternalName()), "eax, " + location(symbolTable.at(operand1).getInternalName()), "; load " + operand1 + " into eax for negation");
     }
 
     emit("", "neg", "eax", "; negate eax");
 
     // Store back
-    emit("", "mov", "[" + symbolTable.at(operand1).getInternalName() + "], eax", "; store negated value into " + operand1);
+    if (operand1 != elidedStore) {
+        emit("", "mov", storeOperands(symbolTable.at(operand1).getInternalName()), "; store negated value into " + operand1);
+    }
 
     contentsOfAReg = operand1;
 }
 
 void Compiler::emitNotCode(string operand1, string /*operand2*/){           // !op1 (operand1 is destination temp)
+    TraceScope span(*this, __func__);
     if (!symbolTable.count(operand1)) {
         processError("reference to undefined symbol in not: " + operand1);
         return;
@@ -1525,133 +2066,77 @@ void Compiler::emitNotCode(string operand1, string /*operand2*/){           // !
 
     // Ensure value is in eax
     if (contentsOfAReg != operand1) {
-        emit("", "mov", "eax, [" + symbolTable.at(operand1).getInternalName() + "]", "; load " + operand1 + " into eax for not");
+        emit("", loadOp(symbolTable.at(operand1).getInternalName()), "eax, " + location(symbolTable.at(operand1).getInternalName()), "; load " + operand1 + " into eax for not");
     }
 
     // Bitwise NOT will flip -1 <-> 0 for boolean representation used earlier
     emit("", "not", "eax", "; bitwise not eax");
 
     // Store back
-    emit("", "mov", "[" + symbolTable.at(operand1).getInternalName() + "], eax", "; store not result into " + operand1);
+    if (operand1 != elidedStore) {
+        emit("", "mov", storeOperands(symbolTable.at(operand1).getInternalName()), "; store not result into " + operand1);
+    }
 
     contentsOfAReg = operand1;
 }
 
 void Compiler::emitAndCode(string operand1, string operand2){           // op2 && op1
-    // operand2 is destination (left), operand1 is right operand
-    if (whichType(operand1) != BOOLEAN || whichType(operand2) != BOOLEAN) {
-        processError("illegal type in and (booleans required)");
-        return;
-    }
-
-    if (!symbolTable.count(operand1)) {
-        if (isLiteral(operand1) || isInteger(operand1) || isBoolean(operand1))
-            insert(operand1, whichType(operand1), CONSTANT, operand1, YES, 1);
-        else {
-            processError("reference to undefined symbol: " + operand1);
-            return;
-        }
-    }
-    if (!symbolTable.count(operand2)) {
-        processError("reference to undefined symbol (destination): " + operand2);
-        return;
-    }
-
-    // Spill unrelated A reg content
-    if (!contentsOfAReg.empty() && contentsOfAReg != operand1 && contentsOfAReg != operand2) {
-        if (symbolTable.count(contentsOfAReg)) {
-            emit("", "mov", "[" + symbolTable.at(contentsOfAReg).getInternalName() + "], eax", "; spill A reg (" + contentsOfAReg + ")");
-            symbolTable.at(contentsOfAReg).setAlloc(YES);
-        }
-        contentsOfAReg.clear();
-    }
-
-    // Load destination (operand2) into eax if not already there
-    if (contentsOfAReg != operand2) {
-        emit("", "mov", "eax, [" + symbolTable.at(operand2).getInternalName() + "]", "; load " + operand2 + " into eax");
-        contentsOfAReg = operand2;
-    }
-
-    // AND with operand1
-    const auto &srcEntry = symbolTable.at(operand1);
-    if (srcEntry.getMode() == CONSTANT && isInteger(srcEntry.getValue())) {
-        emit("", "and", "eax, " + srcEntry.getValue(), "; eax &= " + srcEntry.getValue());
-    } else {
-        emit("", "and", "eax, " + srcEntry.getInternalName(), "; eax &= " + operand1);
-    }
-
-    // Store result back to destination
-    emit("", "mov", "[" + symbolTable.at(operand2).getInternalName() + "], eax", "; store result into " + operand2);
-
-    // Update A register tracking
-    contentsOfAReg = operand2;
-
-    // Free temporary source if needed
-    if (isTemporary(operand1)) freeTemp();
+    TraceScope span(*this, __func__);
+    emitAccumulatorCode<IR_AND>(operand1, operand2);
 }
 
-// Comparison and logical-or emit implementations
-
 void Compiler::emitOrCode(string operand1, string operand2){            // op2 || op1
-    // operand2 is destination (left), operand1 is right
-    if (whichType(operand1) != BOOLEAN || whichType(operand2) != BOOLEAN) {
-        processError("illegal type in or (booleans required)");
-        return;
-    }
+    TraceScope span(*this, __func__);
+    emitAccumulatorCode<IR_OR>(operand1, operand2);
+}
 
-    // Ensure operands exist in symbol table (literals may be inserted)
-    if (!symbolTable.count(operand1)) {
-        if (isLiteral(operand1) || isInteger(operand1) || isBoolean(operand1))
-            insert(operand1, whichType(operand1), CONSTANT, operand1, YES, 1);
-        else {
-            processError("reference to undefined symbol: " + operand1);
-            return;
-        }
-    }
-    if (!symbolTable.count(operand2)) {
-        processError("reference to undefined symbol (destination): " + operand2);
+void Compiler::emitJumpIfFalseCode(string operand1, string operand2){    // if !op1 goto op2
+    TraceScope span(*this, __func__);
+    // operand1 is a boolean temp or variable, operand2 the label to jump to
+    if (!symbolTable.count(operand1) || whichType(operand1) != BOOLEAN) {
+        processError("compiler error: boolean operand expected in conditional jump: " + operand1);
         return;
     }
 
-    // Spill unrelated A reg content
-    if (!contentsOfAReg.empty() && contentsOfAReg != operand1 && contentsOfAReg != operand2) {
-        if (symbolTable.count(contentsOfAReg)) {
-            emit("", "mov", "[" + symbolTable.at(contentsOfAReg).getInternalName() + "], eax", "; spill A reg (" + contentsOfAReg + ")");
-            symbolTable.at(contentsOfAReg).setAlloc(YES);
-        }
-        contentsOfAReg.clear();
+    // Load operand1 into eax if not already there; eax still holds it at the label
+    if (contentsOfAReg != operand1) {
+        emit("", loadOp(symbolTable.at(operand1).getInternalName()), "eax, " + location(symbolTable.at(operand1).getInternalName()), "; load " + operand1 + " into eax");
+        contentsOfAReg = operand1;
     }
 
-    // Load destination (operand2) into eax if not already there
-    if (contentsOfAReg != operand2) {
-        emit("", "mov", "eax, [" + symbolTable.at(operand2).getInternalName() + "]", "; load " + operand2 + " into eax");
-        contentsOfAReg = operand2;
-    }
+    emitCheapest({{{FORM_ALU_IMM8, "cmp", "eax, 0", "; compare " + operand1 + " to FALSE"}},
+                  {{FORM_REG, "test", "eax, eax", "; compare " + operand1 + " to FALSE"}}});
+    emit("", "je", operand2, "; skip the rest if " + operand1 + " is FALSE");
+}
 
-    // OR with operand1
-    const auto &srcEntry = symbolTable.at(operand1);
-    if (srcEntry.getMode() == CONSTANT && isInteger(srcEntry.getValue())) {
-        emit("", "or", "eax, " + srcEntry.getValue(), "; eax |= " + srcEntry.getValue());
-    } else {
-        emit("", "or", "eax, " + srcEntry.getInternalName(), "; eax |= " + operand1);
+void Compiler::emitJumpIfTrueCode(string operand1, string operand2){     // if op1 goto op2
+    TraceScope span(*this, __func__);
+    if (!symbolTable.count(operand1) || whichType(operand1) != BOOLEAN) {
+        processError("compiler error: boolean operand expected in conditional jump: " + operand1);
+        return;
     }
 
-    // Store result back to destination
-    emit("", "mov", "[" + symbolTable.at(operand2).getInternalName() + "], eax", "; store result into " + operand2);
-
-    // Update A register tracking
-    contentsOfAReg = operand2;
+    if (contentsOfAReg != operand1) {
+        emit("", loadOp(symbolTable.at(operand1).getInternalName()), "eax, " + location(symbolTable.at(operand1).getInternalName()), "; load " + operand1 + " into eax");
+        contentsOfAReg = operand1;
+    }
 
-    // Free temporary source if needed
-    if (isTemporary(operand1)) freeTemp();
+    emitCheapest({{{FORM_ALU_IMM8, "cmp", "eax, 0", "; compare " + operand1 + " to FALSE"}},
+                  {{FORM_REG, "test", "eax, eax", "; compare " + operand1 + " to FALSE"}}});
+    emit("", "jne", operand2, "; skip the rest if " + operand1 + " is TRUE");
 }
 
-void Compiler::emitEqualityCode(string operand1, string operand2){      // op2 == op1
+// Comparison emit implementations
+
+// A temp holding op2 op op1 as a boolean (-1 or 0), pushed onto the operand
+// stack, for the six comparisons
+template <irOps op>
+void Compiler::emitComparisonCode(string operand1, string operand2){
     // Types must match
     storeTypes t1 = whichType(operand1);
     storeTypes t2 = whichType(operand2);
     if (t1 != t2) {
-        processError("incompatible types in equality comparison");
+        processError(string("incompatible types in ") + opSpellings[op].name + " comparison");
         return;
     }
 
@@ -1671,8 +2156,9 @@ void Compiler::emitEqualityCode(string operand1, string operand2){      // op2 =
 
     // Spill unrelated A reg content
     if (!contentsOfAReg.empty() && contentsOfAReg != operand1 && contentsOfAReg != operand2) {
-        if (symbolTable.count(contentsOfAReg)) {
-            emit("", "mov", "[" + symbolTable.at(contentsOfAReg).getInternalName() + "], eax", "; spill A reg (" + contentsOfAReg + ")");
+        if (symbolTable.count(contentsOfAReg) && (isTemporary(contentsOfAReg) || contentsOfAReg == elidedStore)) {
+            emit("", "mov", storeOperands(symbolTable.at(contentsOfAReg).getInternalName()), "; spill A reg (" + contentsOfAReg + ")");
+            ++stats.spills;
             symbolTable.at(contentsOfAReg).setAlloc(YES);
         }
         contentsOfAReg.clear();
@@ -1680,31 +2166,36 @@ void Compiler::emitEqualityCode(string operand1, string operand2){      // op2 =
 
     // Load operand2 into eax if not already there
     if (contentsOfAReg != operand2) {
-        emit("", "mov", "eax, [" + symbolTable.at(operand2).getInternalName() + "]", "; load " + operand2 + " into eax");
+        emit("", loadOp(symbolTable.at(operand2).getInternalName()), "eax, " + location(symbolTable.at(operand2).getInternalName()), "; load " + operand2 + " into eax");
         contentsOfAReg = operand2;
     }
 
     // Compare eax with operand1
     const auto &srcEntry = symbolTable.at(operand1);
     if (srcEntry.getMode() == CONSTANT && isInteger(srcEntry.getValue())) {
-        emit("", "cmp", "eax, " + srcEntry.getValue(), "; compare with " + srcEntry.getValue());
+        // test eax, eax sets the flags as cmp eax, 0 does
+        int32_t v = constValue(srcEntry.getValue());
+        vector<vector<AsmLine>> candidates = {{{fitsByte(v) ? FORM_ALU_IMM8 : FORM_ALU_IMM32, opSpellings[op].mnemonic,
+                                               "eax, " + srcEntry.getValue(), "; compare with " + srcEntry.getValue()}}};
+        if (v == 0) candidates.push_back({{FORM_REG, "test", "eax, eax", "; compare with 0"}});
+        emitCheapest(candidates);
     } else {
-        emit("", "cmp", "eax, " + srcEntry.getInternalName(), "; compare with " + operand1);
+        emit("", opSpellings[op].mnemonic, "eax, " + sourceOperand(srcEntry.getInternalName()), "; compare with " + operand1);
     }
 
     // Prepare labels
     string Ltrue = getLabel();
     string Lend  = getLabel();
 
-    // Jump if equal to Ltrue
-    emit("", "JE", Ltrue, "; jump if equal");
+    // Jump to Ltrue if the comparison holds
+    emit("", opSpellings[op].jump, Ltrue, string("; jump if ") + opSpellings[op].effect);
 
     // Load FALSE into eax (0). Ensure 'false' constant exists
     if (!symbolTable.count("false")) {
         insert("false", BOOLEAN, CONSTANT, "0", YES, 1);
     }
-    // Use immediate 0 for speed
-    emit("", "mov", "eax, 0", "; load FALSE");
+    // Use immediate 0 for speed (xor eax, eax)
+    emitCheapest(loadCandidates(0, "; load FALSE"));
     // Jump to end
     emit("", "jmp", Lend, "; jump to end");
 
@@ -1724,11 +2215,7 @@ void Compiler::emitEqualityCode(string operand1, string operand2){      // op2 =
     symbolTable.at(dest).setDataType(BOOLEAN);
 
     // Store eax into dest internal name
-    emit("", "mov", "[" + symbolTable.at(dest).getInternalName() + "], eax", "; store comparison result into " + dest);
-
-    // Deassign/free temporaries used as operands
-    if (isTemporary(operand1)) freeTemp();
-    if (isTemporary(operand2)) freeTemp();
+    emit("", "mov", storeOperands(symbolTable.at(dest).getInternalName()), "; store comparison result into " + dest);
 
     // A register now corresponds to dest
     contentsOfAReg = dest;
@@ -1737,500 +2224,2158 @@ void Compiler::emitEqualityCode(string operand1, string operand2){      // op2 =
     pushOperand(dest);
 }
 
+void Compiler::emitEqualityCode(string operand1, string operand2){      // op2 == op1
+    TraceScope span(*this, __func__);
+    emitComparisonCode<IR_EQ>(operand1, operand2);
+}
+
 void Compiler::emitInequalityCode(string operand1, string operand2){    // op2 != op1
-    // Reuse equality pattern but invert jump
-    storeTypes t1 = whichType(operand1);
-    storeTypes t2 = whichType(operand2);
-    if (t1 != t2) {
-        processError("incompatible types in inequality comparison");
-        return;
-    }
+    TraceScope span(*this, __func__);
+    emitComparisonCode<IR_NE>(operand1, operand2);
+}
 
-    if (!symbolTable.count(operand1)) {
-        if (isLiteral(operand1) || isInteger(operand1) || isBoolean(operand1))
-            insert(operand1, t1, CONSTANT, operand1, YES, 1);
-        else {
-            processError("reference to undefined symbol: " + operand1);
-            return;
-        }
-    }
-    if (!symbolTable.count(operand2)) {
-        processError("reference to undefined symbol: " + operand2);
-        return;
-    }
+void Compiler::emitLessThanCode(string operand1, string operand2){      // op2 < op1
+    TraceScope span(*this, __func__);
+    emitComparisonCode<IR_LT>(operand1, operand2);
+}
 
-    if (!contentsOfAReg.empty() && contentsOfAReg != operand1 && contentsOfAReg != operand2) {
-        if (symbolTable.count(contentsOfAReg)) {
-            emit("", "mov", "[" + symbolTable.at(contentsOfAReg).getInternalName() + "], eax", "; spill A reg (" + contentsOfAReg + ")");
-            symbolTable.at(contentsOfAReg).setAlloc(YES);
-        }
-        contentsOfAReg.clear();
-    }
+void Compiler::emitLessThanOrEqualToCode(string operand1, string operand2){     // op2 <= op1
+    TraceScope span(*this, __func__);
+    emitComparisonCode<IR_LE>(operand1, operand2);
+}
 
-    if (contentsOfAReg != operand2) {
-        emit("", "mov", "eax, [" + symbolTable.at(operand2).getInternalName() + "]", "; load " + operand2 + " into eax");
-        contentsOfAReg = operand2;
-    }
+void Compiler::emitGreaterThanCode(string operand1, string operand2){           // op2 > op1
+    TraceScope span(*this, __func__);
+    emitComparisonCode<IR_GT>(operand1, operand2);
+}
 
-    const auto &srcEntry = symbolTable.at(operand1);
-    if (srcEntry.getMode() == CONSTANT && isInteger(srcEntry.getValue())) {
-        emit("", "cmp", "eax, " + srcEntry.getValue(), "; compare with " + srcEntry.getValue());
-    } else {
-        emit("", "cmp", "eax, " + srcEntry.getInternalName(), "; compare with " + operand1);
-    }
+void Compiler::emitGreaterThanOrEqualToCode(string operand1, string operand2){  // op2 >= op1
+    TraceScope span(*this, __func__);
+    emitComparisonCode<IR_GE>(operand1, operand2);
+}
 
-    string Ltrue = getLabel();
-    string Lend  = getLabel();
+/* ------------------------------------------------------
+    Lexical routines
+    ------------------------------------------------------ */
 
-    // Jump if not equal to Ltrue
-    emit("", "jne", Ltrue, "; jump if not equal");
+char Compiler::nextChar(){       // returns next char or END_OF_FILE marker
+    char next;
 
-    // Load FALSE into eax
-    if (!symbolTable.count("false")) {
-        insert("false", BOOLEAN, CONSTANT, "0", YES, 1);
+    // Try to read next char
+    if (!sourceFile.get(next)) {
+        ch = END_OF_FILE;
+        listingFile << "\n";
+        return ch;
     }
-    emit("", "mov", "eax, 0", "; load FALSE");
-    emit("", "jmp", Lend, "; jump to end");
 
-    emit(Ltrue + ":");
-    if (!symbolTable.count("true")) {
-        insert("true", BOOLEAN, CONSTANT, "-1", YES, 1);
+    ch = next;
+
+    // Print line number for the *first* line if nothing has printed yet
+    if (begChar) {
+        listingFile << std::right << std::setw(5) << lineNo << "|";
+        begChar = false;
     }
-    emit("", "mov", "eax, -1", "; load TRUE");
 
-    emit(Lend + ":");
+    // Print the character
+    listingFile << ch;
 
-    string dest = getTemp();
-    symbolTable.at(dest).setDataType(BOOLEAN);
-    emit("", "mov", "[" + symbolTable.at(dest).getInternalName() + "], eax", "; store comparison result into " + dest);
+    // If we hit a newline, set flag for next line
+    if (ch == '\n') {
+        int peeked = sourceFile.peek();
+        lineNo++;
 
-    if (isTemporary(operand1)) freeTemp();
-    if (isTemporary(operand2)) freeTemp();
+        if (peeked == EOF) {
+            begChar = false;
+        } else {
+            begChar = true;
+        }
+    }
 
-    contentsOfAReg = dest;
-    pushOperand(dest);
+    return ch;
 }
 
-void Compiler::emitLessThanCode(string operand1, string operand2){      // op2 < op1
-    // op2 < op1  (operand2 is left, operand1 is right)
-    if (whichType(operand1) != whichType(operand2)) {
-        processError("incompatible types in less-than comparison");
-        return;
-    }
+string Compiler::nextToken(){   // returns next tok or END_OF_FILE marker
+    PhaseScope timing(*this, STAT_LEX);
+    ++stats.tokens;
+    token.clear();
 
-    if (!symbolTable.count(operand1)) {
-        if (isLiteral(operand1) || isInteger(operand1) || isBoolean(operand1))
-            insert(operand1, whichType(operand1), CONSTANT, operand1, YES, 1);
-        else {
-            processError("reference to undefined symbol: " + operand1);
-            return;
+    // Skip whitespace/comments until we produce a token or hit EOF
+    while (true) {
+        // If we've reached EOF character, return EOF token
+        if (ch == END_OF_FILE) {
+            return END_FILE_TOKEN;
         }
-    }
-    if (!symbolTable.count(operand2)) {
-        processError("reference to undefined symbol: " + operand2);
-        return;
-    }
 
-    if (!contentsOfAReg.empty() && contentsOfAReg != operand1 && contentsOfAReg != operand2) {
-        if (symbolTable.count(contentsOfAReg)) {
-            emit("", "mov", "[" + symbolTable.at(contentsOfAReg).getInternalName() + "], eax", "; spill A reg (" + contentsOfAReg + ")");
-            symbolTable.at(contentsOfAReg).setAlloc(YES);
+        // Skip whitespace
+        if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
+            ch = nextChar();
+            continue;
         }
-        contentsOfAReg.clear();
-    }
 
-    if (contentsOfAReg != operand2) {
-        emit("", "mov", "eax, [" + symbolTable.at(operand2).getInternalName() + "]", "; load " + operand2 + " into eax");
-        contentsOfAReg = operand2;
-    }
+        // Skip comments { ... }
+        if (ch == '{') {
+            // consume '{'
+            ch = nextChar();
+            while (ch != END_OF_FILE && ch != '}') {
+                ch = nextChar();
+            }
+            if (ch == END_OF_FILE) {
+                processError("unexpected end of file in comment");
+                return END_FILE_TOKEN;
+            }
+            // consume closing '}'
+            ch = nextChar();
+            continue;
+        }
 
-    const auto &srcEntry = symbolTable.at(operand1);
-    if (srcEntry.getMode() == CONSTANT && isInteger(srcEntry.getValue())) {
-        emit("", "cmp", "eax, " + srcEntry.getValue(), "; compare with " + srcEntry.getValue());
-    } else {
-        emit("", "cmp", "eax, " + srcEntry.getInternalName(), "; compare with " + operand1);
-    }
+        // Illegal '}' at token start
+        if (ch == '}') {
+            processError("'}' cannot begin token");
+            ch = nextChar();
+            continue;
+        }
 
-    string Ltrue = getLabel();
-    string Lend  = getLabel();
+        // Special symbols (handle two-character tokens)
+        if (isSpecialSymbol(ch)) {
+            char first = ch;
+            char saved = ch;
+            ch = nextChar(); // advance to possibly form two-char token
 
-    // Jump if less (signed)
-    emit("", "JL", Ltrue, "; jump if less");
+            // Two-char combinations
+            if (first == ':' && ch == '=') {
+                token = ":=";
+                ch = nextChar();
+                return token;
+            }
+            if (first == '<' && ch == '=') {
+                token = "<=";
+                ch = nextChar();
+                return token;
+            }
+            if (first == '>' && ch == '=') {
+                token = ">=";
+                ch = nextChar();
+                return token;
+            }
+            if (first == '!' && ch == '=') {
+                token = "!=";
+                ch = nextChar();
+                return token;
+            }
 
-    // FALSE
-    if (!symbolTable.count("false")) insert("false", BOOLEAN, CONSTANT, "0", YES, 1);
-    emit("", "mov", "eax, 0", "; load FALSE");
-    emit("", "jmp", Lend, "; jump to end");
+            // Otherwise single-character special symbol
+            token = std::string(1, saved);
+            return token;
+        }
 
-    emit(Ltrue + ":");
-    if (!symbolTable.count("true")) insert("true", BOOLEAN, CONSTANT, "-1", YES, 1);
-    emit("", "mov", "eax, -1", "; load TRUE");
+        // Identifier or keyword: starts with lowercase letter
+        if (std::islower(static_cast<unsigned char>(ch))) {
+            token.push_back(ch);
+            ch = nextChar();
+            while (ch != END_OF_FILE && (std::isalnum(static_cast<unsigned char>(ch)) || ch == '_')) {
+                token.push_back(ch);
+                ch = nextChar();
+            }
+            // normalize to lowercase already ensured by checks
+            return token;
+        }
 
-    emit(Lend + ":");
+        // Number literal (integer)
+        if (std::isdigit(static_cast<unsigned char>(ch)) || ((ch == '+' || ch == '-') && std::isdigit(static_cast<unsigned char>(sourceFile.peek())))) {
+            // handle optional leading sign followed by digits
+            if (ch == '+' || ch == '-') {
+                token.push_back(ch);
+                ch = nextChar();
+            }
+            while (ch != END_OF_FILE && std::isdigit(static_cast<unsigned char>(ch))) {
+                token.push_back(ch);
+                ch = nextChar();
+            }
+            return token;
+        }
 
-    string dest = getTemp();
-    symbolTable.at(dest).setDataType(BOOLEAN);
-    emit("", "mov", "[" + symbolTable.at(dest).getInternalName() + "], eax", "; store comparison result into " + dest);
+        // EOF check (redundant but safe)
+        if (ch == END_OF_FILE) {
+            return END_FILE_TOKEN;
+        }
 
-    if (isTemporary(operand1)) freeTemp();
-    if (isTemporary(operand2)) freeTemp();
+        // Anything else is illegal
+        {
+            std::string bad(1, ch);
+            processError("illegal symbol '" + bad + "'");
+            ch = nextChar();
+            // continue scanning for next valid token
+        }
+    }
+}
 
-    contentsOfAReg = dest;
-    pushOperand(dest);
+/* ------------------------------------------------------
+    Syntax tree
+    ------------------------------------------------------ */
+
+uint32_t AstArena::newNode(astKinds k, string text, uint32_t line, uint32_t left, uint32_t right){
+    AstNode n;
+    n.kind = static_cast<uint8_t>(k);
+    n.op = IR_ADD;
+    n.need = 1;                 // a leaf is loaded into a temp, unless a right operand
+    n.text = intern(text);
+    n.left = left;
+    n.right = right;
+    n.next = NO_NODE;
+    n.line = line;
+    nodes.push_back(n);         // bump allocation; indices stay valid on growth
+    return static_cast<uint32_t>(nodes.size() - 1);
 }
 
-void Compiler::emitLessThanOrEqualToCode(string operand1, string operand2){     // op2 <= op1
-    if (whichType(operand1) != whichType(operand2)) {
-        processError("incompatible types in less-than-or-equal comparison");
-        return;
-    }
+uint32_t AstArena::intern(const string &s){
+    auto found = interned.find(s);
+    if (found != interned.end()) return found->second;
 
-    if (!symbolTable.count(operand1)) {
-        if (isLiteral(operand1) || isInteger(operand1) || isBoolean(operand1))
-            insert(operand1, whichType(operand1), CONSTANT, operand1, YES, 1);
-        else {
-            processError("reference to undefined symbol: " + operand1);
-            return;
-        }
-    }
-    if (!symbolTable.count(operand2)) {
-        processError("reference to undefined symbol: " + operand2);
-        return;
+    // Store the spelling NUL-terminated so text() can hand out a char*
+    uint32_t offset = static_cast<uint32_t>(pool.size());
+    pool.insert(pool.end(), s.begin(), s.end());
+    pool.push_back('\0');
+    interned.emplace(s, offset);
+    return offset;
+}
+
+size_t AstArena::bytesUsed() const{
+    return nodes.capacity() * sizeof(AstNode) + pool.capacity();
+}
+
+void AstArena::clear(){
+    // swap with empties so the storage itself is returned, not just emptied
+    std::vector<AstNode>().swap(nodes);
+    std::vector<char>().swap(pool);
+    std::unordered_map<std::string, uint32_t>().swap(interned);
+}
+
+void Compiler::appendStmt(uint32_t stmt){
+    if (lastStmt == NO_NODE) {
+        ast.at(astRoot).left = stmt;
+    } else {
+        ast.at(lastStmt).next = stmt;
     }
+    lastStmt = stmt;
+}
 
-    if (!contentsOfAReg.empty() && contentsOfAReg != operand1 && contentsOfAReg != operand2) {
-        if (symbolTable.count(contentsOfAReg)) {
-            emit("", "mov", "[" + symbolTable.at(contentsOfAReg).getInternalName() + "], eax", "; spill A reg (" + contentsOfAReg + ")");
-            symbolTable.at(contentsOfAReg).setAlloc(YES);
+void Compiler::writeAst(ostream &out, uint32_t n, int indent) const{
+    static const char *kindNames[] = {"program", "assign", "read", "write",
+                                      "binary", "unary", "identifier", "literal"};
+    const AstNode &node = ast.at(n);
+    std::string pad(indent + 2, ' ');
+
+    // Writes "key": [ ... ] for a list linked through next
+    auto writeList = [&](const char *key, uint32_t first) {
+        out << ",\n" << pad << "\"" << key << "\": [";
+        for (uint32_t e = first; e != NO_NODE; e = ast.at(e).next) {
+            out << (e == first ? "\n" : ",\n") << std::string(indent + 4, ' ');
+            writeAst(out, e, indent + 4);
         }
-        contentsOfAReg.clear();
-    }
+        out << (first == NO_NODE ? "]" : "\n" + pad + "]");
+    };
 
-    if (contentsOfAReg != operand2) {
-        emit("", "mov", "eax, [" + symbolTable.at(operand2).getInternalName() + "]", "; load " + operand2 + " into eax");
-        contentsOfAReg = operand2;
+    out << "{\n" << pad << "\"kind\": \"" << kindNames[node.kind] << "\",\n"
+        << pad << "\"line\": " << node.line;
+
+    switch (node.kind) {
+    case AST_PROGRAM:
+        out << ",\n" << pad << "\"name\": \"" << ast.text(n) << "\"";
+        writeList("body", node.left);
+        break;
+    case AST_ASSIGN:
+        out << ",\n" << pad << "\"target\": \"" << ast.text(n) << "\",\n"
+            << pad << "\"value\": ";
+        writeAst(out, node.left, indent + 2);
+        break;
+    case AST_READ:
+        writeList("targets", node.left);
+        break;
+    case AST_WRITE:
+        writeList("values", node.left);
+        break;
+    case AST_BINARY:
+        out << ",\n" << pad << "\"op\": \"" << ast.text(n) << "\",\n"
+            << pad << "\"left\": ";
+        writeAst(out, node.left, indent + 2);
+        out << ",\n" << pad << "\"right\": ";
+        writeAst(out, node.right, indent + 2);
+        break;
+    case AST_UNARY:
+        out << ",\n" << pad << "\"op\": \"" << ast.text(n) << "\",\n"
+            << pad << "\"operand\": ";
+        writeAst(out, node.left, indent + 2);
+        break;
+    case AST_IDENT:
+        out << ",\n" << pad << "\"name\": \"" << ast.text(n) << "\"";
+        break;
+    case AST_LITERAL:
+        out << ",\n" << pad << "\"value\": \"" << ast.text(n) << "\"";
+        break;
     }
 
-    const auto &srcEntry = symbolTable.at(operand1);
-    if (srcEntry.getMode() == CONSTANT && isInteger(srcEntry.getValue())) {
-        emit("", "cmp", "eax, " + srcEntry.getValue(), "; compare with " + srcEntry.getValue());
+    out << "\n" << std::string(indent, ' ') << "}";
+}
+
+/* ------------------------------------------------------
+    Intermediate code
+    ------------------------------------------------------ */
+
+IrOperand IrProgram::operand(irOperandKinds k, const string &spelling){
+    auto found = nameIndex.find(spelling);
+    uint32_t index;
+    if (found != nameIndex.end()) {
+        index = found->second;
     } else {
-        emit("", "cmp", "eax, " + srcEntry.getInternalName(), "; compare with " + operand1);
+        index = static_cast<uint32_t>(names.size());
+        names.push_back(spelling);
+        nameIndex.emplace(spelling, index);
     }
+    IrOperand o = {static_cast<uint8_t>(k), index};
+    return o;
+}
 
-    string Ltrue = getLabel();
-    string Lend  = getLabel();
+uint32_t IrProgram::append(irOps op, storeTypes type, IrOperand a, IrOperand b,
+                           uint32_t line, bool definesTemp){
+    IrInst in;
+    in.op = static_cast<uint8_t>(op);
+    in.type = static_cast<uint8_t>(type);
+    in.dest = NO_TEMP;
+    if (definesTemp) {
+        in.dest = static_cast<uint32_t>(tempTypes.size());
+        tempTypes.push_back(static_cast<uint8_t>(type));
+    }
+    in.a = a;
+    in.b = b;
+    in.line = line;
+    code.push_back(in);
+    return in.dest;
+}
 
-    // Jump if less or equal (signed)
-    emit("", "jle", Ltrue, "; jump if less or equal");
+storeTypes Compiler::irType(IrOperand o){
+    if (o.kind == IR_TEMP) return static_cast<storeTypes>(ir.tempTypes[o.index]);
+    return whichType(ir.spelling(o));
+}
 
-    // FALSE
-    if (!symbolTable.count("false")) insert("false", BOOLEAN, CONSTANT, "0", YES, 1);
-    emit("", "mov", "eax, 0", "; load FALSE");
-    emit("", "jmp", Lend, "; jump to end");
+void Compiler::buildIr(){
+    TraceScope span(*this, __func__);
+    // Semantic checks happen here, so the IR handed to later passes is well typed
+    static const IrOperand none = {IR_NONE, 0};
+    uint savedLineNo = lineNo;
+
+    for (uint32_t stmt = ast.at(astRoot).left; stmt != NO_NODE; stmt = ast.at(stmt).next) {
+        const AstNode &n = ast.at(stmt);
+        lineNo = n.line;
+
+        if (n.kind == AST_ASSIGN) {
+            std::string lhs = ast.text(stmt);
+            IrOperand rhs = buildExpr(n.left);
+            if (!symbolTable.count(lhs)) {
+                processError("reference to undefined symbol on left-hand side: " + lhs);
+            }
+            if (symbolTable.at(lhs).getMode() != VARIABLE) {
+                processError("symbol on left-hand side of assignment must have a storage mode of VARIABLE: " + lhs);
+            }
+            storeTypes t = symbolTable.at(lhs).getDataType();
+            if (irType(rhs) != t) {
+                std::string from = rhs.kind == IR_TEMP ? "expression" : ir.spelling(rhs);
+                processError("incompatible types in assignment: " + from + " to " + lhs);
+            }
+            ir.append(IR_STORE, t, ir.operand(IR_NAME, lhs), rhs, n.line, false);
+        } else if (n.kind == AST_READ) {
+            for (uint32_t target = n.left; target != NO_NODE; target = ast.at(target).next) {
+                std::string name = ast.text(target);
+                if (!symbolTable.count(name)) {
+                    processError("reference to undefined symbol: " + name);
+                }
+                if (symbolTable.at(name).getDataType() != INTEGER) {
+                    processError("can't read variables of this type: " + name);
+                }
+                if (symbolTable.at(name).getMode() != VARIABLE) {
+                    processError("attempting to read to a read-only location: " + name);
+                }
+                ir.append(IR_READ, INTEGER, ir.operand(IR_NAME, name), none, n.line, false);
+            }
+        } else if (n.kind == AST_WRITE) {
+            // All values are computed before the first is written, so the
+            // writes end up adjacent and lowerIr can pass them in one call
+            std::vector<IrOperand> values;
+            for (uint32_t value = n.left; value != NO_NODE; value = ast.at(value).next) {
+                IrOperand v = buildExpr(value);
+                storeTypes t = irType(v);
+                if (t != INTEGER && t != BOOLEAN) {
+                    processError(std::string("cannot write value of this type: ") + ast.text(value));
+                }
+                values.push_back(v);
+            }
+            for (IrOperand v : values) {
+                ir.append(IR_WRITE, irType(v), v, none, n.line, false);
+            }
+        } else {
+            processError("compiler error: statement expected in syntax tree");
+        }
+    }
 
-    emit(Ltrue + ":");
-    if (!symbolTable.count("true")) insert("true", BOOLEAN, CONSTANT, "-1", YES, 1);
-    emit("", "mov", "eax, -1", "; load TRUE");
+    lineNo = savedLineNo;
+}
 
-    emit(Lend + ":");
+IrOperand Compiler::buildExpr(uint32_t expr){
+    static const IrOperand none = {IR_NONE, 0};
+    // Post-order walk with an explicit stack, so deep nesting or a long
+    // left-leaning chain (a + b + c ...) costs heap rather than native
+    // stack. A frame is revisited after each of its operands is built;
+    // built operands wait on values. The operand that needs more temps
+    // (AstNode::need) is built first, so fewer of its temps are live while
+    // the other one is computed; and/or keep their order, since the right
+    // operand may be jumped over.
+    struct Frame
+    {
+        uint32_t node;
+        uint8_t built;      // operands on values so far
+        bool rightFirst;    // right operand is built before the left one
+        IrOperand skip;     // short-circuit label, IR_NONE if none
+    };
+    std::vector<Frame> frames(1, Frame{expr, 0, false, none});
+    std::vector<IrOperand> values;
+
+    while (!frames.empty()) {
+        Frame f = frames.back();                        // copy: pushes reallocate
+        const AstNode &n = ast.at(f.node);
+
+        if (n.kind == AST_LITERAL) {
+            values.push_back(ir.operand(IR_CONST, ast.text(f.node)));
+            frames.pop_back();
+            continue;
+        }
+        if (n.kind == AST_IDENT) {
+            std::string name = ast.text(f.node);
+            if (!symbolTable.count(name)) {
+                processError("reference to undefined symbol: " + name);
+            }
+            // Named constants are replaced by their values
+            const SymbolTableEntry &entry = symbolTable.at(name);
+            if (entry.getMode() == CONSTANT && entry.getDataType() != PROG_NAME) {
+                values.push_back(ir.operand(IR_CONST, entry.getValue()));
+            } else {
+                values.push_back(ir.operand(IR_NAME, name));
+            }
+            frames.pop_back();
+            continue;
+        }
 
-    string dest = getTemp();
-    symbolTable.at(dest).setDataType(BOOLEAN);
-    emit("", "mov", "[" + symbolTable.at(dest).getInternalName() + "], eax", "; store comparison result into " + dest);
+        irOps op = static_cast<irOps>(n.op);
+        if (f.built == 0) {
+            bool rightFirst = n.kind == AST_BINARY && op != IR_AND && op != IR_OR
+                              && ast.at(n.right).need > ast.at(n.left).need
+                              && ast.at(n.right).kind != AST_IDENT && ast.at(n.right).kind != AST_LITERAL;
+            frames.back().built = 1;
+            frames.back().rightFirst = rightFirst;
+            frames.push_back(Frame{rightFirst ? n.right : n.left, 0, false, none});
+            continue;
+        }
 
-    if (isTemporary(operand1)) freeTemp();
-    if (isTemporary(operand2)) freeTemp();
+        if (n.kind == AST_BINARY && f.built == 1) {
+            // Binary: the second operand
+            frames.back().built = 2;
+            if (f.rightFirst) {
+                frames.push_back(Frame{n.left, 0, false, none});
+                continue;
+            }
+            IrOperand left = values.back();
+            if ((op == IR_AND || op == IR_OR) && left.kind != IR_CONST
+                && ast.at(n.right).kind != AST_IDENT && ast.at(n.right).kind != AST_LITERAL) {
+                // Short circuit: the right operand takes instructions to compute, so
+                // jump over them once the left operand decides the result. A lone
+                // name or literal is cheaper to and/or in than to branch around, and
+                // a constant left operand is folded instead.
+                IrOperand skip = ir.newLabel();
+                ir.append(op == IR_AND ? IR_JUMPF : IR_JUMPT, BOOLEAN, left, skip, n.line, false);
+                frames.back().skip = skip;
+            }
+            frames.push_back(Frame{n.right, 0, false, none});
+            continue;
+        }
+        frames.pop_back();
+
+        if (n.kind == AST_UNARY) {
+            IrOperand opnd = values.back();
+            values.pop_back();
+            if (op == IR_ADD) {                         // unary plus is a no-op
+                values.push_back(opnd);
+                continue;
+            }
+            bool neg = (op == IR_NEG);
+            if (irType(opnd) != (neg ? INTEGER : BOOLEAN)) {
+                processError(neg ? "illegal type in negation (integer required)"
+                                 : "illegal type in not (boolean required)");
+            }
+            storeTypes t = neg ? INTEGER : BOOLEAN;
+            IrOperand folded = foldConstants(op, t, opnd, none);
+            values.push_back(folded.kind != IR_NONE ? folded
+                             : ir.temp(ir.append(op, t, opnd, none, n.line, true)));
+            continue;
+        }
 
-    contentsOfAReg = dest;
-    pushOperand(dest);
-}
+        IrOperand second = values.back();
+        values.pop_back();
+        IrOperand left = f.rightFirst ? second : values.back();
+        IrOperand right = f.rightFirst ? values.back() : second;
+        values.pop_back();
+        // and/or take booleans, the arithmetic operators integers
+        storeTypes t = (op == IR_AND || op == IR_OR) ? BOOLEAN : INTEGER;
+        if (irType(left) != t || irType(right) != t) {
+            processError(std::string("illegal type in ") + opSpellings[op].name +
+                         (t == INTEGER ? " (integers required)" : " (booleans required)"));
+        }
+        if (f.skip.kind != IR_NONE) {
+            ir.append(IR_LABEL, BOOLEAN, f.skip, none, n.line, false);
+            values.push_back(ir.temp(ir.append(IR_PHI, BOOLEAN, left, right, n.line, true)));
+            continue;
+        }
 
-void Compiler::emitGreaterThanCode(string operand1, string operand2){           // op2 > op1
-    if (whichType(operand1) != whichType(operand2)) {
-        processError("incompatible types in greater-than comparison");
-        return;
+        IrOperand folded = foldConstants(op, t, left, right);
+        if (folded.kind != IR_NONE) {
+            values.push_back(folded);
+            continue;
+        }
+        // lowerIr() computes in the left operand's temp when it dies here,
+        // and otherwise copies the left operand to a new temp first; a
+        // constant goes on the right, where it is an immediate
+        auto rank = [](IrOperand o) { return o.kind == IR_TEMP ? 2 : o.kind == IR_NAME ? 1 : 0; };
+        if ((op == IR_ADD || op == IR_MUL || op == IR_AND || op == IR_OR) && rank(left) < rank(right)) {
+            std::swap(left, right);
+        }
+        values.push_back(ir.temp(ir.append(op, t, left, right, n.line, true)));
     }
+    return values.back();
+}
 
-    if (!symbolTable.count(operand1)) {
-        if (isLiteral(operand1) || isInteger(operand1) || isBoolean(operand1))
-            insert(operand1, whichType(operand1), CONSTANT, operand1, YES, 1);
-        else {
-            processError("reference to undefined symbol: " + operand1);
-            return;
+IrOperand Compiler::foldConstants(irOps op, storeTypes type, IrOperand a, IrOperand b){
+    // Operations on constants are done here, with the 32-bit wraparound the
+    // generated code has; division by zero and INT_MIN / -1 are left to
+    // fault at run time. IR_NONE means the operation stays.
+    IrOperand stays = {IR_NONE, 0};
+    bool unary = (op == IR_NEG || op == IR_NOT);
+    if (a.kind != IR_CONST || (!unary && b.kind != IR_CONST)) return stays;
+    int64_t x = constValue(ir.spelling(a)), y = unary ? 0 : constValue(ir.spelling(b));
+    if ((op == IR_DIV || op == IR_MOD) && (y == 0 || (x == INT32_MIN && y == -1))) return stays;
+    int64_t r;
+    switch (op) {
+    case IR_ADD: r = x + y; break;
+    case IR_SUB: r = x - y; break;
+    case IR_MUL: r = x * y; break;
+    case IR_DIV: r = x / y; break;                  // both truncate like idiv
+    case IR_MOD: r = x % y; break;
+    case IR_AND: r = x & y; break;
+    case IR_OR: r = x | y; break;
+    case IR_NEG: r = -x; break;
+    case IR_NOT: r = ~x; break;
+    default: return stays;
+    }
+    if (type == BOOLEAN) return ir.operand(IR_CONST, r ? "true" : "false");
+    return ir.operand(IR_CONST, std::to_string(static_cast<int32_t>(static_cast<uint32_t>(r))));
+}
+
+int32_t Compiler::constValue(const string &literal) const{
+    // Booleans are stored as -1 and 0, as emitStorage writes them
+    if (literal == "true") return -1;
+    if (literal == "false") return 0;
+    return static_cast<int32_t>(std::stoll(literal));
+}
+
+void Compiler::verifyIr(){
+    TraceScope span(*this, __func__);
+    // Every temp is defined once, before any use; operands and types fit the op.
+    // Jumps go forward to properly nested labels, each label is followed by
+    // the phi for its jump, and a temp defined between a jump and its label
+    // is not used past the label except as the phi's fall-through value.
+    const uint32_t OUTSIDE = 0xFFFFFFFF;
+    std::vector<bool> defined(ir.tempTypes.size(), false);
+    std::vector<uint32_t> regionOf(ir.tempTypes.size(), OUTSIDE);
+    std::vector<bool> opened(ir.labelCount, false), closed(ir.labelCount, false);
+    std::vector<IrOperand> jumpValue(ir.labelCount);
+    std::vector<uint32_t> openLabels;
+    uint savedLineNo = lineNo;
+
+    for (uint32_t i = 0; i < ir.code.size(); ++i) {
+        const IrInst &in = ir.code[i];
+        lineNo = in.line;
+        std::string where = "compiler error: IR instruction " + std::to_string(i) + ": ";
+        const IrOperand *ops[2] = {&in.a, &in.b};
+        bool afterLabel = (i > 0 && ir.code[i - 1].op == IR_LABEL);
+
+        for (int k = 0; k < 2; ++k) {
+            const IrOperand &o = *ops[k];
+            if (o.kind == IR_TEMP && (o.index >= defined.size() || !defined[o.index])) {
+                processError(where + "temporary used before its definition");
+            }
+            if (o.kind == IR_TEMP && regionOf[o.index] != OUTSIDE && closed[regionOf[o.index]]
+                && !(in.op == IR_PHI && k == 1 && afterLabel
+                     && regionOf[o.index] == ir.code[i - 1].a.index)) {
+                processError(where + "temporary used outside the branch that defines it");
+            }
+            if (o.kind == IR_NAME && !symbolTable.count(ir.spelling(o))) {
+                processError(where + "unknown name " + ir.spelling(o));
+            }
+            if (o.kind == IR_LABELNO && (o.index >= ir.labelCount || k != (in.op == IR_LABEL ? 0 : 1))) {
+                processError(where + "misplaced label");
+            }
+        }
+        if ((in.op == IR_PHI) != afterLabel) {
+            processError(where + "a label must be followed by exactly its phi");
         }
-    }
-    if (!symbolTable.count(operand2)) {
-        processError("reference to undefined symbol: " + operand2);
-        return;
-    }
 
-    if (!contentsOfAReg.empty() && contentsOfAReg != operand1 && contentsOfAReg != operand2) {
-        if (symbolTable.count(contentsOfAReg)) {
-            emit("", "mov", "[" + symbolTable.at(contentsOfAReg).getInternalName() + "], eax", "; spill A reg (" + contentsOfAReg + ")");
-            symbolTable.at(contentsOfAReg).setAlloc(YES);
+        bool unary = (in.op == IR_NEG || in.op == IR_NOT || in.op == IR_READ || in.op == IR_WRITE
+                      || in.op == IR_LABEL);
+        if (in.a.kind == IR_NONE || (unary != (in.b.kind == IR_NONE))) {
+            processError(where + "wrong number of operands");
         }
-        contentsOfAReg.clear();
-    }
 
-    if (contentsOfAReg != operand2) {
-        emit("", "mov", "eax, [" + symbolTable.at(operand2).getInternalName() + "]", "; load " + operand2 + " into eax");
-        contentsOfAReg = operand2;
-    }
+        if (in.op == IR_JUMPF || in.op == IR_JUMPT) {
+            if (in.b.kind != IR_LABELNO || opened[in.b.index] || in.dest != NO_TEMP
+                || in.a.kind == IR_LABELNO || irType(in.a) != BOOLEAN) {
+                processError(where + "bad conditional jump");
+            }
+            opened[in.b.index] = true;
+            jumpValue[in.b.index] = in.a;
+            openLabels.push_back(in.b.index);
+        } else if (in.op == IR_LABEL) {
+            if (in.a.kind != IR_LABELNO || openLabels.empty() || openLabels.back() != in.a.index) {
+                processError(where + "label is not the target of the innermost jump");
+            }
+            closed[in.a.index] = true;
+            openLabels.pop_back();
+        } else if (in.op == IR_PHI) {
+            const IrOperand &taken = jumpValue[ir.code[i - 1].a.index];
+            if (in.a.kind != taken.kind || in.a.index != taken.index) {
+                processError(where + "phi does not take the jump's value");
+            }
+            if (in.dest == NO_TEMP || in.dest >= defined.size() || defined[in.dest]) {
+                processError(where + "temporary is not defined exactly once");
+            }
+            if (in.type != BOOLEAN || ir.tempTypes[in.dest] != BOOLEAN
+                || irType(in.a) != BOOLEAN || irType(in.b) != BOOLEAN) {
+                processError(where + "phi types do not match");
+            }
+        } else if ((in.op == IR_STORE || in.op == IR_READ || in.op == IR_WRITE)
+                   && !openLabels.empty()) {
+            processError(where + "statement inside an expression");
+        } else if (in.op == IR_STORE || in.op == IR_READ) {
+            if (in.a.kind != IR_NAME || symbolTable.at(ir.spelling(in.a)).getMode() != VARIABLE) {
+                processError(where + "target is not a variable");
+            }
+            if (in.dest != NO_TEMP || symbolTable.at(ir.spelling(in.a)).getDataType() != in.type) {
+                processError(where + "bad store");
+            }
+        } else if (in.op == IR_WRITE) {
+            if (in.dest != NO_TEMP || irType(in.a) != in.type) {
+                processError(where + "bad write");
+            }
+        } else {
+            if (in.dest == NO_TEMP || in.dest >= defined.size() || defined[in.dest]) {
+                processError(where + "temporary is not defined exactly once");
+            }
+            bool logical = (in.op == IR_AND || in.op == IR_OR || in.op == IR_NOT);
+            bool relational = (in.op >= IR_EQ && in.op <= IR_GE);
+            storeTypes want = logical ? BOOLEAN : INTEGER;
+            if (relational ? irType(in.a) != irType(in.b)
+                           : irType(in.a) != want || (!unary && irType(in.b) != want)) {
+                processError(where + "operand types do not fit " + irOpNames[in.op]);
+            }
+            if (in.type != ((logical || relational) ? BOOLEAN : INTEGER)
+                || ir.tempTypes[in.dest] != in.type) {
+                processError(where + "result type does not fit " + irOpNames[in.op]);
+            }
+        }
 
-    const auto &srcEntry = symbolTable.at(operand1);
-    if (srcEntry.getMode() == CONSTANT && isInteger(srcEntry.getValue())) {
-        emit("", "cmp", "eax, " + srcEntry.getValue(), "; compare with " + srcEntry.getValue());
-    } else {
-        emit("", "cmp", "eax, " + srcEntry.getInternalName(), "; compare with " + operand1);
+        if (in.dest != NO_TEMP && in.dest < defined.size()) {
+            defined[in.dest] = true;
+            if (!openLabels.empty()) regionOf[in.dest] = openLabels.back();
+        }
+    }
+    if (!openLabels.empty()) {
+        processError("compiler error: IR jump without a label");
     }
 
-    string Ltrue = getLabel();
-    string Lend  = getLabel();
-
-    // Jump if greater (signed)
-    emit("", "jg", Ltrue, "; jump if greater");
+    lineNo = savedLineNo;
+}
 
-    // FALSE
-    if (!symbolTable.count("false")) insert("false", BOOLEAN, CONSTANT, "0", YES, 1);
-    emit("", "mov", "eax, 0", "; load FALSE");
-    emit("", "jmp", Lend, "; jump to end");
+void Compiler::numberValues(){
+    TraceScope span(*this, __func__);
+    // Value numbering over the straight-line statement list. An operation
+    // whose opcode and operands match one computed earlier reuses that
+    // temporary. Named operands are keyed with a version that every store
+    // to or read() of the name bumps, so assignments and reads invalidate
+    // exactly the expressions that used the old value. Values computed
+    // between a short-circuit jump and its label may have been skipped, so
+    // they stop being available at the label; a jump left with nothing to
+    // skip is turned back into a plain and/or.
+    typedef std::tuple<uint8_t, uint64_t, uint64_t> ValueKey;
+    std::vector<uint32_t> version(ir.nameCount(), 0);
+    std::vector<uint32_t> leader(ir.tempTypes.size());
+    for (uint32_t t = 0; t < leader.size(); ++t) leader[t] = t;
+
+    auto key = [&](const IrOperand &o) -> uint64_t {
+        uint64_t k = (static_cast<uint64_t>(o.kind) << 62) | o.index;
+        if (o.kind == IR_NAME) k |= static_cast<uint64_t>(version[o.index]) << 32;
+        return k;
+    };
+    std::map<ValueKey, uint32_t> available;
+    std::vector<ValueKey> added;                        // in order, for unwinding at labels
+    std::vector<std::pair<size_t, size_t>> branches;    // (jump in kept, added.size()) per open jump
+    std::vector<IrInst> kept;
+    kept.reserve(ir.code.size());
+    int collapse = -1;                                  // op replacing the next phi, if any
+
+    for (IrInst in : ir.code) {
+        if (in.a.kind == IR_TEMP) in.a.index = leader[in.a.index];
+        if (in.b.kind == IR_TEMP) in.b.index = leader[in.b.index];
+
+        if (in.op == IR_JUMPF || in.op == IR_JUMPT) {
+            branches.push_back(std::make_pair(kept.size(), added.size()));
+            kept.push_back(in);
+            continue;
+        }
+        if (in.op == IR_LABEL) {
+            size_t jump = branches.back().first;
+            for (size_t k = branches.back().second; k < added.size(); ++k) {
+                available.erase(added[k]);
+            }
+            added.resize(branches.back().second);
+            branches.pop_back();
+            if (jump == kept.size() - 1) {              // nothing left to jump over
+                collapse = kept[jump].op == IR_JUMPF ? IR_AND : IR_OR;
+                kept.pop_back();
+            } else {
+                kept.push_back(in);
+            }
+            continue;
+        }
+        if (in.op == IR_PHI) {
+            if (collapse < 0) {
+                kept.push_back(in);
+                continue;
+            }
+            in.op = static_cast<uint8_t>(collapse);
+            collapse = -1;
+        }
 
-    emit(Ltrue + ":");
-    if (!symbolTable.count("true")) insert("true", BOOLEAN, CONSTANT, "-1", YES, 1);
-    emit("", "mov", "eax, -1", "; load TRUE");
+        if (in.op == IR_STORE || in.op == IR_READ) {
+            ++version[in.a.index];
+        }
+        if (in.dest == NO_TEMP) {
+            kept.push_back(in);
+            continue;
+        }
 
-    emit(Lend + ":");
+        uint64_t ka = key(in.a), kb = key(in.b);
+        bool commutative = (in.op == IR_ADD || in.op == IR_MUL || in.op == IR_AND
+                            || in.op == IR_OR || in.op == IR_EQ || in.op == IR_NE);
+        if (commutative && ka > kb) std::swap(ka, kb);
 
-    string dest = getTemp();
-    symbolTable.at(dest).setDataType(BOOLEAN);
-    emit("", "mov", "[" + symbolTable.at(dest).getInternalName() + "], eax", "; store comparison result into " + dest);
+        ValueKey k = std::make_tuple(in.op, ka, kb);
+        auto found = available.find(k);
+        if (found != available.end()) {
+            leader[in.dest] = found->second;        // later uses read the earlier temp
+            ++cseEliminated;
+            continue;
+        }
+        available.emplace(k, in.dest);
+        added.push_back(k);
+        kept.push_back(in);
+    }
 
-    if (isTemporary(operand1)) freeTemp();
-    if (isTemporary(operand2)) freeTemp();
+    ir.code.swap(kept);
+}
 
-    contentsOfAReg = dest;
-    pushOperand(dest);
+void Compiler::initializeStores(){
+    TraceScope span(*this, __func__);
+    // A variable whose first use is a store of a constant can hold that
+    // value from the start: nothing could see the difference. The store is
+    // dropped and the value goes to initialValues (a dd in .data; zero just
+    // stays in .bss). Any other read, write or store makes later stores
+    // to the variable stay.
+    std::vector<bool> used(ir.nameCount(), false);
+    std::vector<IrInst> kept;
+    kept.reserve(ir.code.size());
+    for (const IrInst &in : ir.code) {
+        if (in.op == IR_STORE && in.b.kind == IR_CONST && !used[in.a.index]) {
+            int32_t v = constValue(ir.spelling(in.b));
+            if (v != 0) initialValues[ir.spelling(in.a)] = v;
+            used[in.a.index] = true;
+            ++storesInitialized;
+            continue;
+        }
+        if (in.a.kind == IR_NAME) used[in.a.index] = true;
+        if (in.b.kind == IR_NAME) used[in.b.index] = true;
+        kept.push_back(in);
+    }
+    ir.code.swap(kept);
 }
 
-void Compiler::emitGreaterThanOrEqualToCode(string operand1, string operand2){  // op2 >= op1
-    if (whichType(operand1) != whichType(operand2)) {
-        processError("incompatible types in greater-than-or-equal comparison");
-        return;
+void Compiler::evaluatePrefix(){
+    TraceScope span(*this, __func__);
+    // Only read() brings in values that are unknown at compile time, so the
+    // code before the first read is run here. Variables it sets start with
+    // those values (initialValues, emitted as dd) and its output becomes
+    // one WriteString. It stops early at a division that would fault; the
+    // cut is made where no temp and no and/or region is live.
+    const uint32_t n = static_cast<uint32_t>(ir.code.size());
+    std::vector<int> spans(n + 1, 0);                   // live temps and regions
+    std::vector<uint32_t> defAt(ir.tempTypes.size(), n), lastUse(ir.tempTypes.size(), 0);
+    std::vector<uint32_t> labelAt(ir.labelCount, 0);
+    for (uint32_t i = 0; i < n; ++i) {
+        const IrInst &in = ir.code[i];
+        if (in.dest != NO_TEMP) defAt[in.dest] = i;
+        if (in.a.kind == IR_TEMP) lastUse[in.a.index] = i;
+        if (in.b.kind == IR_TEMP) lastUse[in.b.index] = i;
+        if (in.op == IR_LABEL) labelAt[in.a.index] = i;
+    }
+    for (uint32_t t = 0; t < defAt.size(); ++t) {
+        if (defAt[t] < n && lastUse[t] > defAt[t]) {
+            ++spans[defAt[t] + 1];
+            --spans[lastUse[t] + 1];
+        }
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        if (ir.code[i].op == IR_JUMPF || ir.code[i].op == IR_JUMPT) {
+            ++spans[i + 1];
+            --spans[labelAt[ir.code[i].b.index] + 1];
+        }
     }
 
-    if (!symbolTable.count(operand1)) {
-        if (isLiteral(operand1) || isInteger(operand1) || isBoolean(operand1))
-            insert(operand1, whichType(operand1), CONSTANT, operand1, YES, 1);
-        else {
-            processError("reference to undefined symbol: " + operand1);
-            return;
+    std::vector<int32_t> temps(ir.tempTypes.size(), 0), vars(ir.nameCount(), 0);
+    for (uint32_t k = 0; k < vars.size(); ++k) {
+        IrOperand o = {IR_NAME, k};
+        auto found = initialValues.find(ir.spelling(o));
+        if (found != initialValues.end()) vars[k] = found->second;
+    }
+    std::vector<bool> jumped(ir.labelCount, false);
+    std::vector<std::pair<uint32_t, int32_t>> undo;     // stores since the cut
+    std::string output;
+    size_t outputAtCut = 0;
+    uint32_t cut = 0;
+    auto value = [&](IrOperand o) -> int64_t {
+        if (o.kind == IR_TEMP) return temps[o.index];
+        if (o.kind == IR_NAME) return vars[o.index];
+        return o.kind == IR_CONST ? constValue(ir.spelling(o)) : 0;
+    };
+
+    int live = 0;
+    uint32_t i = 0;
+    for (; i < n; ++i) {
+        live += spans[i];
+        if (live == 0) {
+            cut = i;
+            outputAtCut = output.size();
+            undo.clear();
         }
+        const IrInst &in = ir.code[i];
+        if (in.op == IR_READ) break;
+        int64_t x = value(in.a), y = value(in.b), r = 0;
+        if ((in.op == IR_DIV || in.op == IR_MOD) && (y == 0 || (x == INT32_MIN && y == -1))) break;
+        switch (in.op) {
+        case IR_STORE:
+            undo.emplace_back(in.a.index, vars[in.a.index]);
+            vars[in.a.index] = static_cast<int32_t>(y);
+            continue;
+        case IR_WRITE:
+            output += writeIntText(static_cast<int32_t>(x));
+            continue;
+        case IR_JUMPF:
+        case IR_JUMPT:
+            if ((x == 0) == (in.op == IR_JUMPF)) {
+                jumped[in.b.index] = true;
+                for (uint32_t j = i + 1; j < labelAt[in.b.index]; ++j) live += spans[j];
+                i = labelAt[in.b.index] - 1;            // continue at the label
+            }
+            continue;
+        case IR_LABEL:
+            continue;
+        case IR_PHI: r = jumped[ir.code[i - 1].a.index] ? x : y; break;
+        case IR_ADD: r = x + y; break;
+        case IR_SUB: r = x - y; break;
+        case IR_MUL: r = x * y; break;
+        case IR_DIV: r = x / y; break;
+        case IR_MOD: r = x % y; break;
+        case IR_AND: r = x & y; break;
+        case IR_OR: r = x | y; break;
+        case IR_EQ: r = x == y ? -1 : 0; break;
+        case IR_NE: r = x != y ? -1 : 0; break;
+        case IR_LT: r = x < y ? -1 : 0; break;
+        case IR_LE: r = x <= y ? -1 : 0; break;
+        case IR_GT: r = x > y ? -1 : 0; break;
+        case IR_GE: r = x >= y ? -1 : 0; break;
+        case IR_NEG: r = -x; break;
+        case IR_NOT: r = ~x; break;
+        default: break;
+        }
+        temps[in.dest] = static_cast<int32_t>(static_cast<uint32_t>(r));
     }
-    if (!symbolTable.count(operand2)) {
-        processError("reference to undefined symbol: " + operand2);
-        return;
+    if (i == n && live + spans[n] == 0) {
+        cut = n;                                        // the whole program ran
+        outputAtCut = output.size();
+        undo.clear();
     }
 
-    if (!contentsOfAReg.empty() && contentsOfAReg != operand1 && contentsOfAReg != operand2) {
-        if (symbolTable.count(contentsOfAReg)) {
-            emit("", "mov", "[" + symbolTable.at(contentsOfAReg).getInternalName() + "], eax", "; spill A reg (" + contentsOfAReg + ")");
-            symbolTable.at(contentsOfAReg).setAlloc(YES);
+    // Back out the part of the statement that could not finish
+    for (auto u = undo.rbegin(); u != undo.rend(); ++u) vars[u->first] = u->second;
+    output.resize(outputAtCut);
+    for (uint32_t k = 0; k < vars.size(); ++k) {
+        IrOperand o = {IR_NAME, k};
+        if (vars[k] != 0) initialValues[ir.spelling(o)] = vars[k];
+        else initialValues.erase(ir.spelling(o));
+    }
+    prefixOutput = output;
+    prefixEvaluated = cut;
+    ir.code.erase(ir.code.begin(), ir.code.begin() + cut);
+}
+
+void Compiler::lowerIr(){
+    TraceScope span(*this, __func__);
+    // Each IR temporary is held in a compiler temporary (Tn) from its
+    // definition to its last use; an operation whose left operand dies there
+    // computes in place, otherwise the left operand is copied to a fresh temp
+    // first, as the emit routines expect (op2 = op2 op op1). That copy is
+    // not stored, and neither is a result used only by the next instruction
+    // as its left operand or stored value: eax still holds it there
+    std::vector<uint32_t> lastUse(ir.tempTypes.size(), 0), uses(ir.tempTypes.size(), 0);
+    std::vector<uint32_t> phiAt(ir.labelCount, 0);
+    for (uint32_t i = 0; i < ir.code.size(); ++i) {
+        if (ir.code[i].a.kind == IR_TEMP) {
+            lastUse[ir.code[i].a.index] = i;
+            ++uses[ir.code[i].a.index];
         }
-        contentsOfAReg.clear();
+        if (ir.code[i].b.kind == IR_TEMP) {
+            lastUse[ir.code[i].b.index] = i;
+            ++uses[ir.code[i].b.index];
+        }
+        if (ir.code[i].op == IR_LABEL) phiAt[ir.code[i].a.index] = i + 1;
+    }
+    // The next instruction, if the one use of instruction i's result is there
+    auto onlyUser = [&](uint32_t i) -> const IrInst * {
+        const IrInst &in = ir.code[i];
+        if (in.dest == NO_TEMP || uses[in.dest] != 1 || i + 1 == ir.code.size()) return nullptr;
+        const IrInst &next = ir.code[i + 1];
+        const IrOperand &use = next.op == IR_STORE ? next.b : next.a;
+        return use.kind == IR_TEMP && use.index == in.dest ? &next : nullptr;
+    };
+    auto inRegister = [&](uint32_t i) {
+        const IrInst *next = onlyUser(i);
+        irOps op = static_cast<irOps>(ir.code[i].op);
+        return next && op != IR_MOD && (op < IR_EQ || op > IR_GE) && op <= IR_NOT
+               && (next->op <= IR_NOT || next->op == IR_STORE);
+    };
+    // x * m + a and x := x + a are each lowered as one tile, so the first
+    // can be a lea and the second add dword [x], a when formCosts says so
+    auto constantOf = [&](IrOperand o, int32_t &value) {
+        if (o.kind != IR_CONST) return false;
+        value = constValue(ir.spelling(o));
+        return true;
+    };
+
+    std::vector<std::string> tempOf(ir.tempTypes.size());
+    std::vector<std::string> labelOf(ir.labelCount), joinOf(ir.labelCount);
+    auto name = [&](IrOperand o) -> std::string {
+        if (o.kind == IR_NONE || o.kind == IR_LABELNO) return "";
+        return o.kind == IR_TEMP ? tempOf[o.index] : ir.spelling(o);
+    };
+    uint savedLineNo = lineNo;
+
+    if (!prefixOutput.empty()) {
+        emitWriteStringCode(prefixOutput);          // what evaluatePrefix() printed
+    }
+
+    for (uint32_t i = 0; i < ir.code.size(); ++i) {
+        const IrInst &in = ir.code[i];
+        lineNo = in.line;
+        std::string a = name(in.a), b = name(in.b);
+        std::string dest;
+        const IrInst *next = onlyUser(i);
+        int32_t multiplier = 0, addend = 0;
+        bool covered = false;                               // next is part of this tile
+
+        if (in.op == IR_STORE) {
+            emitAssignCode(b, a);
+        } else if (in.op == IR_READ || in.op == IR_WRITE) {
+            // Runs of reads or writes are lowered together, so they can share
+            // runtime calls
+            uint32_t first = i;
+            std::vector<std::string> items(1, a);
+            while (i + 1 < ir.code.size() && ir.code[i + 1].op == in.op) {
+                items.push_back(name(ir.code[++i].a));
+            }
+            if (in.op == IR_READ) emitReadListCode(items);
+            else emitWriteListCode(items);
+            for (uint32_t j = first; j <= i; ++j) {
+                const IrOperand &o = ir.code[j].a;
+                if (o.kind == IR_TEMP && lastUse[o.index] == j) freeTemp(items[j - first]);
+            }
+            continue;
+        } else if (in.op == IR_JUMPF || in.op == IR_JUMPT) {
+            // The join temp carries the left value over the jump and gets the
+            // right value on the fall-through path; the left temp serves if it
+            // dies at the phi
+            uint32_t l = in.b.index;
+            if (in.a.kind == IR_TEMP && lastUse[in.a.index] == phiAt[l]) {
+                joinOf[l] = a;
+            } else {
+                joinOf[l] = getTemp();
+                symbolTable.at(joinOf[l]).setDataType(BOOLEAN);
+                emitAssignCode(a, joinOf[l]);
+            }
+            labelOf[l] = getLabel();
+            if (in.op == IR_JUMPF) {
+                emitJumpIfFalseCode(joinOf[l], labelOf[l]);
+            } else {
+                emitJumpIfTrueCode(joinOf[l], labelOf[l]);
+            }
+            ++shortCircuits;
+        } else if (in.op == IR_LABEL) {
+            uint32_t l = in.a.index;
+            emitAssignCode(name(ir.code[i + 1].b), joinOf[l]);
+            emit(labelOf[l] + ":");
+            // Both paths arrive with the join value in eax
+            if (contentsOfAReg != joinOf[l]) contentsOfAReg.clear();
+        } else if (in.op == IR_PHI) {
+            dest = joinOf[ir.code[i - 1].a.index];
+        } else if (in.op >= IR_EQ && in.op <= IR_GE) {
+            // Comparisons allocate their own boolean result temp. They load
+            // the left operand into eax from its storage, so a left-hand
+            // literal needs its constant entry first; they only enter a
+            // right-hand literal themselves, since that one is an immediate
+            enterLiteral(a);
+            code(static_cast<irOps>(in.op), b, a);
+            dest = popOperand();
+        } else if ((in.op == IR_ADD || in.op == IR_SUB) && in.a.kind == IR_NAME && constantOf(in.b, addend)
+                   && next && next->op == IR_STORE && next->a.index == in.a.index
+                   && emitIncrementCode(a, in.op == IR_ADD ? addend : negated(addend))) {
+            ++i;                                            // the store is done too
+            continue;
+        } else {
+            if (in.a.kind == IR_TEMP && lastUse[in.a.index] == i) {
+                dest = a;                                   // left operand dies here
+            } else {
+                dest = getTemp();
+                symbolTable.at(dest).setDataType(static_cast<storeTypes>(in.type));
+                elidedStore = dest;
+                emitAssignCode(a, dest);
+            }
+            covered = in.op == IR_MUL && constantOf(in.b, multiplier) && next
+                      && (next->op == IR_ADD || next->op == IR_SUB) && constantOf(next->b, addend);
+            elidedStore = inRegister(covered ? i + 1 : i) ? dest : "";
+            if (covered) {
+                emitAffineCode(dest, multiplier, next->op == IR_ADD ? addend : negated(addend));
+            } else if (in.op == IR_NEG) {
+                emitNegationCode(dest);
+            } else if (in.op == IR_NOT) {
+                emitNotCode(dest);
+            } else {
+                code(static_cast<irOps>(in.op), b, dest);
+            }
+            elidedStore.clear();
+        }
+
+        if (in.dest != NO_TEMP) tempOf[in.dest] = dest;
+
+        // Release operand temps whose last use this was (unless reused as dest)
+        if (in.a.kind == IR_TEMP && lastUse[in.a.index] == i && a != dest) freeTemp(a);
+        if (in.b.kind == IR_TEMP && lastUse[in.b.index] == i && b != dest && b != a) freeTemp(b);
+        if (covered) tempOf[ir.code[++i].dest] = dest;      // the add or sub of x * m + a
     }
 
-    if (contentsOfAReg != operand2) {
-        emit("", "mov", "eax, [" + symbolTable.at(operand2).getInternalName() + "]", "; load " + operand2 + " into eax");
-        contentsOfAReg = operand2;
+    lineNo = savedLineNo;
+}
+
+void Compiler::writeIr(ostream &out) const{
+    // README notation: x := y + 5  ->  t1 = y + 5, x = t1
+    auto name = [&](IrOperand o) -> std::string {
+        if (o.kind == IR_LABELNO) return "L" + std::to_string(o.index);
+        return o.kind == IR_TEMP ? "t" + std::to_string(o.index) : ir.spelling(o);
+    };
+
+    out << "program " << ast.text(astRoot) << "\n";
+    if (cseEliminated > 0) {
+        out << "    ; value numbering removed " << cseEliminated << " operations\n";
+    }
+    if (shortCircuits > 0) {
+        out << "    ; " << shortCircuits << " and/or short-circuited\n";
+    }
+    if (storesInitialized > 0) {
+        out << "    ; " << storesInitialized << " constant stores became initial values\n";
+    }
+    if (prefixEvaluated > 0) {
+        out << "    ; " << prefixEvaluated << " instructions evaluated at compile time\n";
+    }
+    for (const IrInst &in : ir.code) {
+        if (in.op == IR_LABEL) {
+            out << "  " << name(in.a) << ":\n";
+            continue;
+        }
+        out << "    ";
+        switch (in.op) {
+        case IR_JUMPF:
+        case IR_JUMPT:
+            out << irOpNames[in.op] << " " << name(in.a) << " goto " << name(in.b);
+            break;
+        case IR_PHI:
+            out << "t" << in.dest << " = phi " << name(in.a) << ", " << name(in.b);
+            break;
+        case IR_STORE:
+            out << name(in.a) << " = " << name(in.b);
+            break;
+        case IR_READ:
+            out << "read " << name(in.a);
+            break;
+        case IR_WRITE:
+            out << "write " << name(in.a);
+            break;
+        case IR_NEG:
+        case IR_NOT:
+            out << "t" << in.dest << " = " << irOpNames[in.op] << " " << name(in.a);
+            break;
+        default:
+            out << "t" << in.dest << " = " << name(in.a) << " " << irOpNames[in.op]
+                << " " << name(in.b);
+        }
+        out << "\n";
     }
+}
 
-    const auto &srcEntry = symbolTable.at(operand1);
-    if (srcEntry.getMode() == CONSTANT && isInteger(srcEntry.getValue())) {
-        emit("", "CMP", "eax, " + srcEntry.getValue(), "; compare with " + srcEntry.getValue());
-    } else {
-        emit("", "CMP", "eax, " + srcEntry.getInternalName(), "; compare with " + operand1);
+void Compiler::writeLayout(ostream &out) const{
+    // One line per dd, db or resd in the order emitStorage() placed them,
+    // with the 64-byte cache line each starts on, then a summary per section
+    out << "; data layout: most referenced first, sections aligned to 64 bytes\n";
+    out << std::left << std::setw(8) << "section" << std::setw(8) << "offset" << std::setw(6) << "line"
+        << std::setw(7) << "bytes" << std::setw(7) << "refs" << std::setw(8) << "label" << "name\n";
+    for (const StorageItem &item : layout) {
+        out << std::setw(8) << item.section << std::setw(8) << item.offset << std::setw(6) << item.offset / 64
+            << std::setw(7) << item.bytes << std::setw(7) << item.refs << std::setw(8) << item.label
+            << item.name << "\n";
+    }
+    for (const char *section : {".data", ".bss"}) {
+        uint32_t bytes = 0;
+        uint refs = 0, firstLine = 0;
+        for (const StorageItem &item : layout) {
+            if (item.section != section) continue;
+            bytes = item.offset + item.bytes;
+            refs += item.refs;
+            if (item.offset < 64) firstLine += item.refs;
+        }
+        out << "; " << section << ": " << bytes << " bytes, " << (bytes + 63) / 64 << " cache line(s), "
+            << refs << " references, " << firstLine << " of them to line 0\n";
     }
+}
 
-    string Ltrue = getLabel();
-    string Lend  = getLabel();
+/* ------------------------------------------------------
+    Object file
+    ------------------------------------------------------ */
 
-    // Jump if greater or equal (signed)
-    emit("", "JGE", Ltrue, "; jump if greater or equal");
+static std::string lowerCase(std::string s){
+    for (char &c : s) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return s;
+}
 
-    // FALSE
-    if (!symbolTable.count("false")) insert("false", BOOLEAN, CONSTANT, "0", YES, 1);
-    emit("", "mov", "eax, 0", "; load FALSE");
-    emit("", "jmp", Lend, "; jump to end");
+static std::string trimmed(const std::string &s){
+    size_t first = s.find_first_not_of(" \t");
+    if (first == std::string::npos) return "";
+    return s.substr(first, s.find_last_not_of(" \t") - first + 1);
+}
 
-    emit(Ltrue + ":");
-    if (!symbolTable.count("true")) insert("true", BOOLEAN, CONSTANT, "-1", YES, 1);
-    emit("", "mov", "eax, -1", "; load TRUE");
+// Splits "a, b" at top-level commas (quoted strings may contain commas)
+static std::vector<std::string> splitOperands(const std::string &s){
+    std::vector<std::string> parts;
+    std::string cur;
+    char quote = 0;
+    for (char c : s) {
+        if (quote) {
+            if (c == quote) quote = 0;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == ',') {
+            parts.push_back(trimmed(cur));
+            cur.clear();
+            continue;
+        }
+        cur += c;
+    }
+    if (!trimmed(cur).empty() || !parts.empty()) parts.push_back(trimmed(cur));
+    return parts;
+}
 
-    emit(Lend + ":");
+// Decimal, 0x hex or NASM's trailing-h hex, with an optional sign, in [p, end)
+static bool parseNumber(const char *p, const char *end, int64_t &value){
+    while (p < end && (*p == ' ' || *p == '\t')) ++p;
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t')) --end;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+    int base = 10;
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        base = 16;
+        p += 2;
+    } else if (end - p > 1 && (end[-1] == 'h' || end[-1] == 'H') && std::isdigit(static_cast<unsigned char>(*p))) {
+        base = 16;
+        --end;
+    }
+    if (p == end || end - p > 10) return false;
+    int64_t v = 0;
+    for (; p < end; ++p) {
+        char c = static_cast<char>(std::tolower(static_cast<unsigned char>(*p)));
+        int d = std::isdigit(static_cast<unsigned char>(c)) ? c - '0'
+              : (base == 16 && c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+        if (d < 0) return false;
+        v = v * base + d;
+    }
+    if (v > 0xFFFFFFFFLL) return false;
+    value = neg ? -v : v;
+    return true;
+}
 
-    string dest = getTemp();
-    symbolTable.at(dest).setDataType(BOOLEAN);
-    emit("", "mov", "[" + symbolTable.at(dest).getInternalName() + "], eax", "; store comparison result into " + dest);
+static bool parseNumber(const std::string &s, int64_t &value){
+    return parseNumber(s.data(), s.data() + s.size(), value);
+}
 
-    if (isTemporary(operand1)) freeTemp();
-    if (isTemporary(operand2)) freeTemp();
+static void put16(std::vector<uint8_t> &buf, uint32_t v){
+    buf.push_back(static_cast<uint8_t>(v));
+    buf.push_back(static_cast<uint8_t>(v >> 8));
+}
 
-    contentsOfAReg = dest;
-    pushOperand(dest);
+static void put32(std::vector<uint8_t> &buf, uint32_t v){
+    put16(buf, v & 0xFFFF);
+    put16(buf, v >> 16);
 }
 
-/* ------------------------------------------------------
-    Lexical routines
-    ------------------------------------------------------ */
+static void patch32(std::vector<uint8_t> &buf, uint32_t at, uint32_t v){
+    for (int k = 0; k < 4; ++k) buf[at + k] = static_cast<uint8_t>(v >> (8 * k));
+}
 
-char Compiler::nextChar(){       // returns next char or END_OF_FILE marker
-    char next;
+static uint32_t read32(const std::vector<uint8_t> &buf, uint32_t at){
+    return buf[at] | buf[at + 1] << 8 | buf[at + 2] << 16 | static_cast<uint32_t>(buf[at + 3]) << 24;
+}
 
-    // Try to read next char
-    if (!sourceFile.get(next)) {
-        ch = END_OF_FILE;
-        listingFile << "\n";
-        return ch;
+bool ElfObject::assemble(const string &label, const string &instruction, const string &operands){
+    std::string l = trimmed(label), ins = trimmed(instruction), ops = trimmed(operands);
+    std::string dir = lowerCase(l);
+
+    if (dir == "section" || dir == "segment") {
+        std::string name = lowerCase(ins);
+        current = name == ".text" ? TEXT : name == ".data" ? DATA : name == ".bss" ? BSS : UNDEF;
+        if (current == UNDEF) return false;
+        int64_t n;
+        if (ops.empty()) return true;
+        if (lowerCase(ops).compare(0, 6, "align=") != 0 || !parseNumber(ops.substr(6), n)
+            || n <= 0 || n > 4096 || (n & (n - 1)) != 0) {
+            return false;
+        }
+        alignment[current] = std::max(alignment[current], static_cast<uint32_t>(n));
+        return true;
     }
-
-    ch = next;
-
-    // Print line number for the *first* line if nothing has printed yet
-    if (begChar) {
-        listingFile << std::right << std::setw(5) << lineNo << "|";
-        begChar = false;
+    if (dir == "global") {
+        globals.insert(ins);
+        return true;
+    }
+    if (dir == "extern") {
+        return true;                                // undefined names are external anyway
+    }
+    if (dir == "bits") {
+        bits = ins == "64" ? 64 : 32;
+        return ins == "64" || ins == "32";
+    }
+    if (dir == "default") {
+        return lowerCase(ins) == "rel";             // RIP-relative is all BITS 64 encodes
     }
 
-    // Print the character
-    listingFile << ch;
-
-    // If we hit a newline, set flag for next line
-    if (ch == '\n') {
-        int peeked = sourceFile.peek();
-        lineNo++;
+    if (!l.empty()) {
+        if (l.back() == ':') l.pop_back();
+        if (!define(l)) return false;
+    }
+    if (ins.empty()) return true;
 
-        if (peeked == EOF) {
-            begChar = false;
-        } else {
-            begChar = true;
+    std::string m = lowerCase(ins);
+    if (m == "dd" || m == "db") {
+        if (current != DATA) return false;
+        for (const std::string &item : splitOperands(ops)) {
+            int64_t v;
+            if (m == "db" && item.size() >= 2 && (item[0] == '\'' || item[0] == '"')
+                && item.back() == item[0]) {
+                data.insert(data.end(), item.begin() + 1, item.end() - 1);
+            } else if (parseNumber(item, v)) {
+                if (m == "dd") put32(data, static_cast<uint32_t>(v));
+                else data.push_back(static_cast<uint8_t>(v));
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (m == "resd" || m == "resb") {
+        int64_t n;
+        if (current != BSS || !parseNumber(ops, n) || n < 0) return false;
+        bssSize += static_cast<uint32_t>(m == "resd" ? 4 * n : n);
+        return true;
+    }
+
+    if (current != TEXT) return false;
+    size_t firstFixup = fixups.size();
+    if (!this->instruction(m, ops)) return false;
+    // RIP-relative displacements count from the end of the instruction,
+    // which may still hold an immediate after the displacement
+    for (size_t k = firstFixup; k < fixups.size(); ++k) {
+        if (fixups[k].kind == RIPREL) {
+            uint32_t after = textSize() - (fixups[k].offset + 4);
+            patch32(text, fixups[k].offset, read32(text, fixups[k].offset) - after);
         }
     }
+    return true;
+}
 
-    return ch;
+uint32_t ElfObject::symbolId(const string &name){
+    auto found = symbolIndex.find(name);
+    if (found != symbolIndex.end()) return found->second;
+    uint32_t id = static_cast<uint32_t>(symbols.size());
+    Symbol sym = {UNDEF, 0};
+    symbols.push_back(sym);
+    symbolNames.push_back(name);
+    symbolIndex.emplace(name, id);
+    return id;
 }
 
-string Compiler::nextToken(){   // returns next tok or END_OF_FILE marker
-    token.clear();
+bool ElfObject::define(const string &name){
+    if (name.empty()) return false;
+    Symbol &sym = symbols[symbolId(name)];
+    if (sym.section != UNDEF) return false;
+    sym.section = current;
+    sym.offset = current == TEXT ? textSize()
+               : current == DATA ? static_cast<uint32_t>(data.size()) : bssSize;
+    return true;
+}
 
-    // Skip whitespace/comments until we produce a token or hit EOF
-    while (true) {
-        // If we've reached EOF character, return EOF token
-        if (ch == END_OF_FILE) {
-            return END_FILE_TOKEN;
+bool ElfObject::parseOperand(const char *p, const char *end, Operand &o){
+    // Scans the text in place; the emit routines call this for every operand
+    static const char regs[8][4] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi"};
+    static const char regs64[8][5] = {"r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+    static const char wide[8][4] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi"};
+    auto lower = [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); };
+    while (p < end && (*p == ' ' || *p == '\t')) ++p;
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t')) --end;
+    o.size = 4;
+    if (end - p > 6 && lower(p[0]) == 'd' && lower(p[1]) == 'w' && lower(p[2]) == 'o'
+        && lower(p[3]) == 'r' && lower(p[4]) == 'd' && p[5] == ' ') {
+        p += 6;
+        while (p < end && *p == ' ') ++p;
+    } else if (end - p > 5 && lower(p[0]) == 'b' && lower(p[1]) == 'y' && lower(p[2]) == 't'
+               && lower(p[3]) == 'e' && p[4] == ' ') {
+        p += 5;
+        o.size = 1;
+        while (p < end && *p == ' ') ++p;
+    }
+    o.value = 0;
+
+    // al, cl, dl, bl and (BITS 64) r8b-r15b: the byte stores of --pack-booleans
+    static const char regs8[4][3] = {"al", "cl", "dl", "bl"};
+    if (o.size == 4 && end - p >= 2 && end - p <= 4) {
+        std::string name(p, end);
+        for (char &c : name) c = lower(c);
+        for (uint8_t r = 0; r < 4; ++r) {
+            if (name == regs8[r]) {
+                o.kind = 'r';
+                o.reg = r;
+                o.size = 1;
+                return true;
+            }
         }
-
-        // Skip whitespace
-        if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
-            ch = nextChar();
-            continue;
+        if (bits == 64 && name.size() >= 3 && name[0] == 'r' && name.back() == 'b') {
+            int n = std::atoi(name.c_str() + 1);
+            if (n >= 8 && n <= 15 && name == "r" + std::to_string(n) + "b") {
+                o.kind = 'r';
+                o.reg = static_cast<uint8_t>(n);
+                o.size = 1;
+                return true;
+            }
         }
+    }
 
-        // Skip comments { ... }
-        if (ch == '{') {
-            // consume '{'
-            ch = nextChar();
-            while (ch != END_OF_FILE && ch != '}') {
-                ch = nextChar();
+    if (end - p == 3 || end - p == 4) {
+        std::string name(p, end);
+        for (char &c : name) c = lower(c);
+        for (uint8_t r = 0; r < 8; ++r) {
+            if (name == regs[r] || (bits == 64 && name == regs64[r])) {
+                o.kind = 'r';
+                o.reg = static_cast<uint8_t>(name == regs[r] ? r : r + 8);
+                return true;
             }
-            if (ch == END_OF_FILE) {
-                processError("unexpected end of file in comment");
-                return END_FILE_TOKEN;
+            if (bits == 64 && name == wide[r]) {
+                o.kind = 'q';                       // 64-bit register, lea only
+                o.reg = r;
+                return true;
             }
-            // consume closing '}'
-            ch = nextChar();
-            continue;
         }
+    }
+    if (parseNumber(p, end, o.value)) {
+        o.kind = 'i';
+        return true;
+    }
 
-        // Illegal '}' at token start
-        if (ch == '}') {
-            processError("'}' cannot begin token");
-            ch = nextChar();
-            continue;
+    // [name] or [name+n] / [name-n]: absolute memory; a bare name is its address
+    bool memory = (end - p > 2 && *p == '[' && end[-1] == ']');
+    if (memory) {
+        ++p;
+        --end;
+    }
+    if (memory && p < end && (lower(*p) == 'e' || lower(*p) == 'r') && parseAddress(p, end, o)) return true;
+    const char *sign = std::find_if(p, end, [](char c) { return c == '+' || c == '-'; });
+    if (sign != end && !parseNumber(sign, end, o.value)) return false;
+    while (p < sign && *p == ' ') ++p;
+    while (sign > p && sign[-1] == ' ') --sign;
+    if (p == sign || !(std::isalpha(static_cast<unsigned char>(*p)) || *p == '_' || *p == '.')) {
+        return false;
+    }
+    o.kind = memory ? 'm' : 's';
+    o.symbol = symbolId(std::string(p, sign));
+    return true;
+}
+
+bool ElfObject::parseAddress(const char *p, const char *end, Operand &o){
+    // [eax + eax*4 + 3]: registers (rax-rdi under BITS 64, the address size)
+    // and numbers joined by + or -; one register may be scaled by 1, 2, 4 or 8
+    static const char regs[8][4] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi"};
+    static const char wide[8][4] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi"};
+    const char (*names)[4] = bits == 64 ? wide : regs;
+    uint8_t base = NO_REGISTER, index = NO_REGISTER, scale = 1;
+    int64_t displacement = 0;
+    char sign = '+';
+    for (;;) {
+        const char *next = std::find_if(p, end, [](char c) { return c == '+' || c == '-'; });
+        std::string term = trimmed(std::string(p, next));
+        for (char &c : term) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        size_t star = term.find('*');
+        std::string name = trimmed(term.substr(0, star));
+        uint8_t r = 0;
+        while (r < 8 && name != names[r]) ++r;
+        int64_t n;
+        if (r < 8 && sign == '+') {
+            if (star != std::string::npos) {
+                std::string factor = trimmed(term.substr(star + 1));
+                if (index != NO_REGISTER || (factor != "1" && factor != "2" && factor != "4" && factor != "8")) {
+                    return false;
+                }
+                index = r;
+                scale = static_cast<uint8_t>(factor[0] - '0');
+            } else if (base == NO_REGISTER) {
+                base = r;
+            } else if (index == NO_REGISTER) {
+                index = r;
+            } else {
+                return false;
+            }
+        } else if (star == std::string::npos && parseNumber(term, n)) {
+            displacement += sign == '-' ? -n : n;
+        } else {
+            return false;
         }
+        if (next == end) break;
+        sign = *next;
+        p = next + 1;
+    }
+    if ((base == NO_REGISTER && index == NO_REGISTER) || index == 4) return false;  // esp is no index
+    o.kind = 'a';
+    o.base = base;
+    o.index = index;
+    o.scale = scale;
+    o.value = displacement;
+    return true;
+}
 
-        // Special symbols (handle two-character tokens)
-        if (isSpecialSymbol(ch)) {
-            char first = ch;
-            char saved = ch;
-            ch = nextChar(); // advance to possibly form two-char token
+void ElfObject::reference(const Operand &o, fixupKinds kind){
+    Fixup f = {textSize(), o.symbol, static_cast<uint8_t>(kind)};
+    fixups.push_back(f);
+    // The field holds the addend until write() resolves the symbol
+    put32(text, static_cast<uint32_t>(kind == ABSOLUTE ? o.value : o.value - 4));
+}
 
-            // Two-char combinations
-            if (first == ':' && ch == '=') {
-                token = ":=";
-                ch = nextChar();
-                return token;
-            }
-            if (first == '<' && ch == '=') {
-                token = "<=";
-                ch = nextChar();
-                return token;
-            }
-            if (first == '>' && ch == '=') {
-                token = ">=";
-                ch = nextChar();
-                return token;
-            }
-            if (first == '!' && ch == '=') {
-                token = "!=";
-                ch = nextChar();
-                return token;
-            }
+void ElfObject::rex(uint8_t reg, const Operand &rm){
+    uint8_t prefix = static_cast<uint8_t>((reg >= 8 ? 4 : 0) | (rm.kind == 'r' && rm.reg >= 8 ? 1 : 0));
+    if (prefix) text.push_back(0x40 | prefix);
+}
 
-            // Otherwise single-character special symbol
-            token = std::string(1, saved);
-            return token;
+void ElfObject::modrm(uint8_t digit, const Operand &rm){
+    if (rm.kind == 'r') {
+        text.push_back(static_cast<uint8_t>(0xC0 | (digit & 7) << 3 | (rm.reg & 7)));
+    } else {
+        // [disp32] in 32-bit code, [rip+disp32] in 64-bit code
+        text.push_back(static_cast<uint8_t>(0x05 | (digit & 7) << 3));
+        reference(rm, bits == 64 ? RIPREL : ABSOLUTE);
+    }
+}
+
+void ElfObject::address(uint8_t reg, const Operand &a){
+    // Always through a SIB byte; without a base the displacement is 32 bits,
+    // and ebp as a base takes at least a byte of it
+    static const uint8_t scaleBits[9] = {0, 0, 1, 0, 2, 0, 0, 0, 3};
+    bool noBase = a.base == NO_REGISTER;
+    uint8_t mod = noBase || (a.value == 0 && a.base != 5) ? 0 : a.value >= -128 && a.value <= 127 ? 1 : 2;
+    text.push_back(static_cast<uint8_t>(mod << 6 | (reg & 7) << 3 | 4));
+    text.push_back(static_cast<uint8_t>(scaleBits[a.scale] << 6 | (a.index == NO_REGISTER ? 4 : a.index) << 3
+                                        | (noBase ? 5 : a.base)));
+    if (mod == 1) text.push_back(static_cast<uint8_t>(a.value));
+    else if (mod == 2 || noBase) put32(text, static_cast<uint32_t>(a.value));
+}
+
+bool ElfObject::instruction(const string &m, const string &operands){
+    static const std::map<std::string, uint8_t> alu = {
+        {"add", 0}, {"or", 1}, {"adc", 2}, {"sbb", 3}, {"and", 4}, {"sub", 5}, {"xor", 6}, {"cmp", 7}};
+    static const std::map<std::string, uint8_t> unary = {
+        {"not", 2}, {"neg", 3}, {"mul", 4}, {"imul", 5}, {"div", 6}, {"idiv", 7}};
+    static const std::map<std::string, uint8_t> jcc = {
+        {"jo", 0x80}, {"jno", 0x81}, {"jb", 0x82}, {"jae", 0x83}, {"je", 0x84}, {"jz", 0x84},
+        {"jne", 0x85}, {"jnz", 0x85}, {"jbe", 0x86}, {"ja", 0x87}, {"js", 0x88}, {"jns", 0x89},
+        {"jl", 0x8C}, {"jge", 0x8D}, {"jle", 0x8E}, {"jg", 0x8F}};
+
+    // Exit {code}: the Along32 macro, a sys_exit system call
+    if (m == "exit" && bits == 32) {
+        int64_t status = 0;
+        std::string arg = trimmed(operands);
+        if (!arg.empty() && arg.front() == '{' && arg.back() == '}') arg = arg.substr(1, arg.size() - 2);
+        if (!arg.empty() && !parseNumber(arg, status)) return false;
+        text.push_back(0xB8);                       // mov eax, 1
+        put32(text, 1);
+        text.push_back(0xBB);                       // mov ebx, status
+        put32(text, static_cast<uint32_t>(status));
+        text.push_back(0xCD);                       // int 80h
+        text.push_back(0x80);
+        return true;
+    }
+
+    // Instruction operands never contain quoted commas
+    Operand ops[2];
+    size_t count = 0;
+    const char *p = operands.data(), *end = p + operands.size();
+    while (p < end) {
+        const char *comma = std::find(p, end, ',');
+        if (count == 2 || !parseOperand(p, comma, ops[count++])) return false;
+        p = comma == end ? end : comma + 1;
+    }
+    auto fits8 = [](int64_t v) { return v >= -128 && v <= 127; };
+    auto rm = [](const Operand &o) { return o.kind == 'r' || o.kind == 'm'; };
+    auto immediate = [&](int64_t v, bool small) {
+        if (small) text.push_back(static_cast<uint8_t>(v));
+        else put32(text, static_cast<uint32_t>(v));
+    };
+
+    if (count == 0) {
+        if (m == "cdq") text.push_back(0x99);
+        else if (m == "ret") text.push_back(0xC3);
+        else if (m == "nop") text.push_back(0x90);
+        else if (m == "syscall" && bits == 64) {
+            text.push_back(0x0F);
+            text.push_back(0x05);
+        } else return false;
+        return true;
+    }
+
+    if (count == 1) {
+        const Operand &o = ops[0];
+        if ((m == "call" || m == "jmp") && o.kind == 's') {
+            text.push_back(m == "call" ? 0xE8 : 0xE9);
+            reference(o, BRANCH);
+        } else if (jcc.count(m) && o.kind == 's') {
+            text.push_back(0x0F);
+            text.push_back(jcc.at(m));
+            reference(o, BRANCH);
+        } else if (unary.count(m) && rm(o)) {
+            rex(0, o);
+            text.push_back(0xF7);
+            modrm(unary.at(m), o);
+        } else if ((m == "push" || m == "pop") && o.kind == 'r' && bits == 32) {
+            text.push_back(static_cast<uint8_t>((m == "push" ? 0x50 : 0x58) + o.reg));
+        } else if (m == "int" && o.kind == 'i') {
+            text.push_back(0xCD);
+            text.push_back(static_cast<uint8_t>(o.value));
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    const Operand &dst = ops[0], &src = ops[1];
+
+    // Byte operands: movsx r32, byte [m] and mov byte [m], r8/imm8 only
+    if (dst.size == 1 || src.size == 1) {
+        if (m == "movsx" && dst.kind == 'r' && dst.size == 4 && src.kind == 'm' && src.size == 1) {
+            rex(dst.reg, src);
+            text.push_back(0x0F);
+            text.push_back(0xBE);
+            modrm(dst.reg, src);
+        } else if (m == "mov" && dst.kind == 'm' && dst.size == 1 && src.kind == 'r' && src.size == 1) {
+            rex(src.reg, dst);
+            text.push_back(0x88);
+            modrm(src.reg, dst);
+        } else if (m == "mov" && dst.kind == 'm' && dst.size == 1 && src.kind == 'i') {
+            text.push_back(0xC6);
+            modrm(0, dst);
+            text.push_back(static_cast<uint8_t>(src.value));
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    if (m == "mov") {
+        if (dst.kind == 'r' && (src.kind == 'i' || src.kind == 's')) {
+            rex(0, dst);
+            text.push_back(static_cast<uint8_t>(0xB8 + (dst.reg & 7)));
+            if (src.kind == 'i') put32(text, static_cast<uint32_t>(src.value));
+            else reference(src, ABSOLUTE);
+        } else if (dst.kind == 'm' && src.kind == 'i') {
+            text.push_back(0xC7);
+            modrm(0, dst);
+            put32(text, static_cast<uint32_t>(src.value));
+        } else if (rm(dst) && src.kind == 'r') {
+            rex(src.reg, dst);
+            text.push_back(0x89);
+            modrm(src.reg, dst);
+        } else if (dst.kind == 'r' && src.kind == 'm') {
+            rex(dst.reg, src);
+            text.push_back(0x8B);
+            modrm(dst.reg, src);
+        } else {
+            return false;
+        }
+    } else if (alu.count(m)) {
+        uint8_t n = alu.at(m);
+        if (rm(dst) && src.kind == 'i') {
+            rex(0, dst);
+            text.push_back(fits8(src.value) ? 0x83 : 0x81);
+            modrm(n, dst);
+            immediate(src.value, fits8(src.value));
+        } else if (rm(dst) && src.kind == 'r') {
+            rex(src.reg, dst);
+            text.push_back(static_cast<uint8_t>(0x01 + 8 * n));
+            modrm(src.reg, dst);
+        } else if (dst.kind == 'r' && src.kind == 'm') {
+            rex(dst.reg, src);
+            text.push_back(static_cast<uint8_t>(0x03 + 8 * n));
+            modrm(dst.reg, src);
+        } else {
+            return false;
+        }
+    } else if (m == "lea" && (src.kind == 'm' || src.kind == 'a')
+               && (dst.kind == 'r' || (dst.kind == 'q' && bits == 64))) {
+        if (dst.kind == 'q') text.push_back(0x48);  // REX.W
+        else rex(dst.reg, src);
+        text.push_back(0x8D);
+        if (src.kind == 'a') address(dst.reg, src);
+        else modrm(dst.reg, src);
+    } else if (m == "shl" && rm(dst) && src.kind == 'i') {
+        rex(0, dst);
+        text.push_back(0xC1);
+        modrm(4, dst);
+        text.push_back(static_cast<uint8_t>(src.value));
+    } else if (m == "test" && rm(dst) && src.kind == 'r') {
+        rex(src.reg, dst);
+        text.push_back(0x85);
+        modrm(src.reg, dst);
+    } else if (m == "imul" && dst.kind == 'r') {
+        if (src.kind == 'i') {
+            rex(dst.reg, dst);
+            text.push_back(fits8(src.value) ? 0x6B : 0x69);
+            modrm(dst.reg, dst);
+            immediate(src.value, fits8(src.value));
+        } else if (rm(src)) {
+            rex(dst.reg, src);
+            text.push_back(0x0F);
+            text.push_back(0xAF);
+            modrm(dst.reg, src);
+        } else {
+            return false;
         }
+    } else {
+        return false;
+    }
+    return true;
+}
 
-        // Identifier or keyword: starts with lowercase letter
-        if (std::islower(static_cast<unsigned char>(ch))) {
-            token.push_back(ch);
-            ch = nextChar();
-            while (ch != END_OF_FILE && (std::isalnum(static_cast<unsigned char>(ch)) || ch == '_')) {
-                token.push_back(ch);
-                ch = nextChar();
-            }
-            // normalize to lowercase already ensured by checks
-            return token;
+void ElfObject::write(ostream &out){
+    // ELF32 with .rel.text for i386, ELF64 with .rela.text for x86-64.
+    // Section header indices; the first three symbols are the sections
+    enum {SH_NULL, SH_TEXT, SH_DATA, SH_BSS, SH_REL, SH_SYMTAB, SH_STRTAB, SH_SHSTRTAB,
+          SH_NOTE, SH_COUNT};
+    const uint32_t R_386_32 = 1, R_386_PC32 = 2;
+    const uint32_t R_X86_64_PC32 = 2, R_X86_64_PLT32 = 4, R_X86_64_32 = 10;
+    const bool wide = (bits == 64);
+    const uint32_t symSize = wide ? 24 : 16, relSize = wide ? 24 : 8;
+    auto word = [&](std::vector<uint8_t> &buf, uint64_t v) {   // Elf32_Addr or Elf64_Addr
+        put32(buf, static_cast<uint32_t>(v));
+        if (wide) put32(buf, static_cast<uint32_t>(v >> 32));
+    };
+
+    std::vector<uint8_t> symtab, strtab(1, 0), rel;
+    auto addSymbol = [&](const std::string &name, uint32_t value, uint8_t info, uint16_t shndx) {
+        put32(symtab, name.empty() ? 0 : static_cast<uint32_t>(strtab.size()));
+        if (!name.empty()) {
+            strtab.insert(strtab.end(), name.begin(), name.end());
+            strtab.push_back(0);
+        }
+        if (!wide) {
+            put32(symtab, value);
+            put32(symtab, 0);
         }
+        symtab.push_back(info);
+        symtab.push_back(0);
+        put16(symtab, shndx);
+        if (wide) {
+            word(symtab, value);
+            word(symtab, 0);
+        }
+    };
+
+    addSymbol("", 0, 0, 0);
+    for (uint16_t sec = TEXT; sec <= BSS; ++sec) addSymbol("", 0, 3, sec);   // STT_SECTION
+    for (const std::string &name : globals) symbolId(name);
+    std::vector<bool> isGlobal(symbols.size(), false);
+    for (const std::string &name : globals) isGlobal[symbolId(name)] = true;
+    for (uint32_t id = 0; id < symbols.size(); ++id) {
+        if (isGlobal[id] || symbols[id].section == UNDEF) continue;
+        addSymbol(symbolNames[id], symbols[id].offset, symbols[id].section == TEXT ? 0 : 1,
+                  symbols[id].section);
+    }
+
+    // Globals follow the locals; every name never defined is an external
+    uint32_t firstGlobal = static_cast<uint32_t>(symtab.size() / symSize);
+    std::vector<uint32_t> globalIndex(symbols.size(), 0);
+    for (uint32_t id = 0; id < symbols.size(); ++id) {
+        if (!isGlobal[id] && symbols[id].section != UNDEF) continue;
+        globalIndex[id] = static_cast<uint32_t>(symtab.size() / symSize);
+        uint8_t info = symbols[id].section == UNDEF ? 0x10 : symbols[id].section == TEXT ? 0x12 : 0x11;
+        addSymbol(symbolNames[id], symbols[id].offset, info, symbols[id].section);
+    }
+
+    for (const Fixup &f : fixups) {
+        uint32_t addend = read32(text, f.offset);
+        const Symbol &sym = symbols[f.symbol];
+        if (sym.section == TEXT && f.kind != ABSOLUTE) {
+            patch32(text, f.offset, addend + sym.offset - f.offset);   // pc-relative within .text
+            continue;
+        }
+        uint32_t symIndex;
+        if (sym.section != UNDEF && !isGlobal[f.symbol]) {
+            addend += sym.offset;                                       // section-relative
+            symIndex = sym.section;
+        } else {
+            symIndex = globalIndex[f.symbol];
+        }
+        if (!wide) {
+            patch32(text, f.offset, addend);                            // implicit addend
+            put32(rel, f.offset);
+            put32(rel, symIndex << 8 | (f.kind == ABSOLUTE ? R_386_32 : R_386_PC32));
+        } else {
+            uint32_t type = f.kind == ABSOLUTE ? R_X86_64_32
+                          : f.kind == BRANCH && sym.section == UNDEF ? R_X86_64_PLT32 : R_X86_64_PC32;
+            patch32(text, f.offset, 0);
+            word(rel, f.offset);
+            word(rel, static_cast<uint64_t>(symIndex) << 32 | type);
+            word(rel, static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(addend))));
+        }
+    }
 
-        // Number literal (integer)
-        if (std::isdigit(static_cast<unsigned char>(ch)) || ((ch == '+' || ch == '-') && std::isdigit(static_cast<unsigned char>(sourceFile.peek())))) {
-            // handle optional leading sign followed by digits
-            if (ch == '+' || ch == '-') {
-                token.push_back(ch);
-                ch = nextChar();
-            }
-            while (ch != END_OF_FILE && std::isdigit(static_cast<unsigned char>(ch))) {
-                token.push_back(ch);
-                ch = nextChar();
-            }
-            return token;
+    static const char *const shNames[SH_COUNT] = {"", ".text", ".data", ".bss", ".rel.text",
+        ".symtab", ".strtab", ".shstrtab", ".note.GNU-stack"};
+    std::vector<uint8_t> shstrtab(1, 0);
+    uint32_t shName[SH_COUNT] = {0};
+    for (int k = 1; k < SH_COUNT; ++k) {
+        shName[k] = static_cast<uint32_t>(shstrtab.size());
+        std::string name = (k == SH_REL && wide) ? ".rela.text" : shNames[k];
+        shstrtab.insert(shstrtab.end(), name.begin(), name.end());
+        shstrtab.push_back(0);
+    }
+
+    // Layout: ELF header, section contents (aligned), section headers
+    const uint32_t ehSize = wide ? 64 : 52, shSize = wide ? 64 : 40;
+    std::vector<uint8_t> file(ehSize, 0);
+    uint32_t offset[SH_COUNT] = {0}, size[SH_COUNT] = {0};
+    const std::vector<uint8_t> *contents[SH_COUNT] = {nullptr, &text, &data, nullptr, &rel,
+        &symtab, &strtab, &shstrtab, nullptr};
+    for (int k = 1; k < SH_COUNT; ++k) {
+        while (file.size() % (k == SH_TEXT ? alignment[TEXT] : k == SH_DATA ? alignment[DATA]
+                              : wide ? 8 : 4)) file.push_back(0);
+        offset[k] = static_cast<uint32_t>(file.size());
+        if (contents[k]) {
+            file.insert(file.end(), contents[k]->begin(), contents[k]->end());
+            size[k] = static_cast<uint32_t>(contents[k]->size());
         }
+    }
+    size[SH_BSS] = bssSize;
+    while (file.size() % 8) file.push_back(0);
+    uint32_t shoff = static_cast<uint32_t>(file.size());
+
+    const uint32_t align = wide ? 8 : 4;
+    struct {uint32_t type, flags, link, info, align, entsize;} sh[SH_COUNT] = {
+        {0, 0, 0, 0, 0, 0},
+        {1, 6, 0, 0, 16, 0},                          // PROGBITS, ALLOC|EXECINSTR
+        {1, 3, 0, 0, alignment[DATA], 0},             // PROGBITS, WRITE|ALLOC
+        {8, 3, 0, 0, alignment[BSS], 0},              // NOBITS
+        {wide ? 4u : 9u, 0, SH_SYMTAB, SH_TEXT, align, relSize},   // RELA or REL
+        {2, 0, SH_STRTAB, firstGlobal, align, symSize},            // SYMTAB
+        {3, 0, 0, 0, 1, 0},                           // STRTAB
+        {3, 0, 0, 0, 1, 0},
+        {1, 0, 0, 0, 1, 0}};                          // no executable stack
+    for (int k = 0; k < SH_COUNT; ++k) {
+        put32(file, shName[k]);
+        put32(file, sh[k].type);
+        word(file, sh[k].flags);
+        word(file, 0);
+        word(file, k ? offset[k] : 0);
+        word(file, size[k]);
+        put32(file, sh[k].link);
+        put32(file, sh[k].info);
+        word(file, sh[k].align);
+        word(file, sh[k].entsize);
+    }
+
+    // ELFCLASS32 or ELFCLASS64, little endian
+    const uint8_t ident[16] = {0x7F, 'E', 'L', 'F', static_cast<uint8_t>(wide ? 2 : 1), 1, 1};
+    std::vector<uint8_t> header(ident, ident + 16);
+    put16(header, 1);                                 // ET_REL
+    put16(header, wide ? 62 : 3);                     // EM_X86_64 or EM_386
+    put32(header, 1);
+    word(header, 0);                                  // no entry point
+    word(header, 0);                                  // no program headers
+    word(header, shoff);
+    put32(header, 0);
+    put16(header, static_cast<uint16_t>(ehSize));
+    put16(header, 0);
+    put16(header, 0);
+    put16(header, static_cast<uint16_t>(shSize));
+    put16(header, SH_COUNT);
+    put16(header, SH_SHSTRTAB);
+    std::copy(header.begin(), header.end(), file.begin());
+
+    out.write(reinterpret_cast<const char *>(file.data()), static_cast<std::streamsize>(file.size()));
+}
 
-        // EOF check (redundant but safe)
-        if (ch == END_OF_FILE) {
-            return END_FILE_TOKEN;
+void *ElfObject::load(const string &entry, const unordered_map<string, void *> &externs,
+                      string &error){
+#ifdef STAGE1_CAN_RUN
+    if (bits != 64) {
+        error = "only x86-64 code can be run";
+        return nullptr;
+    }
+    // Layout: .text, a 16-byte jump stub per external, then .data and .bss
+    // from the next page so the code pages can be made read-only
+    std::vector<uint32_t> stub(symbols.size(), 0);
+    uint32_t codeSize = textSize();
+    for (uint32_t id = 0; id < symbols.size(); ++id) {
+        if (symbols[id].section != UNDEF) continue;
+        if (!externs.count(symbolNames[id])) {
+            error = "undefined symbol " + symbolNames[id];
+            return nullptr;
+        }
+        codeSize = (codeSize + 15) & ~15u;
+        stub[id] = codeSize;
+        codeSize += 16;
+    }
+    auto entryIt = symbolIndex.find(entry);
+    if (entryIt == symbolIndex.end() || symbols[entryIt->second].section != TEXT) {
+        error = "no entry point " + entry;
+        return nullptr;
+    }
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t dataStart = (codeSize + page - 1) / page * page;
+    const size_t bssStart = (dataStart + data.size() + alignment[BSS] - 1) / alignment[BSS] * alignment[BSS];
+    const size_t total = bssStart + bssSize;
+    void *mem = mmap(nullptr, total ? total : 1, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        error = "cannot map " + std::to_string(total) + " bytes";
+        return nullptr;
+    }
+    uint8_t *base = static_cast<uint8_t *>(mem);       // .bss is already zero
+    std::copy(text.begin(), text.end(), base);
+    std::copy(data.begin(), data.end(), base + dataStart);
+    for (uint32_t id = 0; id < symbols.size(); ++id) {
+        if (symbols[id].section != UNDEF) continue;
+        static const uint8_t jmp[6] = {0xFF, 0x25, 0, 0, 0, 0};   // jmp [rip+0]
+        void *target = externs.find(symbolNames[id])->second;
+        std::memcpy(base + stub[id], jmp, sizeof jmp);
+        std::memcpy(base + stub[id] + sizeof jmp, &target, sizeof target);
+    }
+
+    const uint64_t sectionBase[] = {0, 0, dataStart, bssStart};
+    for (const Fixup &f : fixups) {
+        const Symbol &sym = symbols[f.symbol];
+        if (f.kind == ABSOLUTE) {
+            error = "absolute reference to " + symbolNames[f.symbol];
+            return nullptr;
         }
+        uint64_t at = sym.section == UNDEF ? stub[f.symbol] : sectionBase[sym.section] + sym.offset;
+        int32_t field = static_cast<int32_t>(read32(text, f.offset) + at - f.offset);
+        std::memcpy(base + f.offset, &field, sizeof field);
+    }
+    if (dataStart && mprotect(base, dataStart, PROT_READ | PROT_EXEC) != 0) {
+        error = "cannot make the code executable";
+        return nullptr;
+    }
+    return base + symbols[entryIt->second].offset;
+#else
+    (void)entry;
+    (void)externs;
+    error = "--run needs an x86-64 Linux host";
+    return nullptr;
+#endif
+}
 
-        // Anything else is illegal
-        {
-            std::string bad(1, ch);
-            processError("illegal symbol '" + bad + "'");
-            ch = nextChar();
-            // continue scanning for next valid token
+/* ------------------------------------------------------
+    In-process runtime (--run)
+    ------------------------------------------------------ */
+
+#ifdef STAGE1_CAN_RUN
+// The same entry points as runtime/pascallite.c, backed by cin and cout.
+// The generated code calls them through stage1ReadInt etc. below, which
+// keep every register but eax intact like Along32 does.
+
+// Parsed byte by byte as pascalliteReadInt does, not with operator>>, so
+// input reads the same as in the linked program: leading white space is
+// skipped, the value wraps around, a byte that starts no number reads as
+// 0 and is consumed, and the end of input gives 0
+extern "C" int stage1RunReadInt(){
+    std::streambuf *in = std::cin.rdbuf();
+    int c = in->sbumpc();
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r') c = in->sbumpc();
+    bool negative = false;
+    if (c == '-' || c == '+') {
+        negative = (c == '-');
+        c = in->sbumpc();
+    }
+    uint32_t value = 0;
+    while (c >= '0' && c <= '9') {
+        value = value * 10 + static_cast<uint32_t>(c - '0');
+        c = in->sbumpc();
+    }
+    return static_cast<int32_t>(negative ? 0u - value : value);
+}
+
+extern "C" void stage1RunWriteInt(int value){
+    int64_t v = value;
+    std::cout << (v < 0 ? '-' : '+') << (v < 0 ? -v : v);
+}
+
+extern "C" void stage1RunCrlf(){
+    std::cout << '\n';
+}
+
+extern "C" void stage1RunWriteString(const char *text){
+    std::cout << text;
+}
+
+extern "C" void stage1RunReadInts(int *values, int count){
+    for (int k = 0; k < count; ++k) values[k] = stage1RunReadInt();
+}
+
+extern "C" void stage1RunWriteInts(const int *values, int count){
+    for (int k = 0; k < count; ++k) {
+        stage1RunWriteInt(values[k]);
+        stage1RunCrlf();
+    }
+}
+
+extern "C" void stage1ReadInt();
+extern "C" void stage1WriteInt();
+extern "C" void stage1Crlf();
+extern "C" void stage1WriteString();
+extern "C" void stage1ReadInts();
+extern "C" void stage1WriteInts();
+extern "C" void stage1Enter(void *code);    // saves the callee-saved registers
+
+__asm__(
+    ".intel_syntax noprefix\n"
+    ".text\n"
+    ".macro STAGE1_SAVE\n"
+    "    push rbp\n    mov rbp, rsp\n    and rsp, -16\n"
+    "    push rcx\n    push rdx\n    push rsi\n    push rdi\n"
+    "    push r8\n    push r9\n    push r10\n    push r11\n"
+    ".endm\n"
+    ".macro STAGE1_RESTORE\n"
+    "    pop r11\n    pop r10\n    pop r9\n    pop r8\n"
+    "    pop rdi\n    pop rsi\n    pop rdx\n    pop rcx\n"
+    "    mov rsp, rbp\n    pop rbp\n"
+    ".endm\n"
+    "stage1ReadInt:\n"
+    "    STAGE1_SAVE\n    call stage1RunReadInt@PLT\n    STAGE1_RESTORE\n    ret\n"
+    "stage1WriteInt:\n"
+    "    STAGE1_SAVE\n    push rax\n    push rax\n    mov edi, eax\n"
+    "    call stage1RunWriteInt@PLT\n    pop rax\n    pop rax\n    STAGE1_RESTORE\n    ret\n"
+    "stage1Crlf:\n"
+    "    STAGE1_SAVE\n    push rax\n    push rax\n"
+    "    call stage1RunCrlf@PLT\n    pop rax\n    pop rax\n    STAGE1_RESTORE\n    ret\n"
+    "stage1WriteString:\n"
+    "    STAGE1_SAVE\n    push rax\n    push rax\n    mov rdi, rdx\n"
+    "    call stage1RunWriteString@PLT\n    pop rax\n    pop rax\n    STAGE1_RESTORE\n    ret\n"
+    "stage1ReadInts:\n"
+    "    STAGE1_SAVE\n    push rax\n    push rax\n    mov rdi, rsi\n    mov esi, ecx\n"
+    "    call stage1RunReadInts@PLT\n    pop rax\n    pop rax\n    STAGE1_RESTORE\n    ret\n"
+    "stage1WriteInts:\n"
+    "    STAGE1_SAVE\n    push rax\n    push rax\n    mov rdi, rsi\n    mov esi, ecx\n"
+    "    call stage1RunWriteInts@PLT\n    pop rax\n    pop rax\n    STAGE1_RESTORE\n    ret\n"
+    "stage1Enter:\n"
+    "    push rbx\n    push rbp\n    push r12\n    push r13\n    push r14\n    push r15\n"
+    "    call rdi\n"
+    "    pop r15\n    pop r14\n    pop r13\n    pop r12\n    pop rbp\n    pop rbx\n    ret\n"
+    ".att_syntax prefix\n");
+#endif
+
+int Compiler::run(){
+    if (!runProgram) return EXIT_SUCCESS;
+    std::string error;
+    void *entry = nullptr;
+#ifdef STAGE1_CAN_RUN
+    std::unordered_map<std::string, void *> runtime = {
+        {"ReadInt", reinterpret_cast<void *>(&stage1ReadInt)},
+        {"WriteInt", reinterpret_cast<void *>(&stage1WriteInt)},
+        {"Crlf", reinterpret_cast<void *>(&stage1Crlf)},
+        {"WriteString", reinterpret_cast<void *>(&stage1WriteString)},
+        {"ReadInts", reinterpret_cast<void *>(&stage1ReadInts)},
+        {"WriteInts", reinterpret_cast<void *>(&stage1WriteInts)}};
+    entry = elf.load("_start", runtime, error);
+#else
+    entry = elf.load("_start", {}, error);
+#endif
+    if (!entry) {
+        // Not a source error, so processError's listing trailer does not apply
+        std::cerr << "ERROR: --run: " << error << std::endl;
+        return EXIT_FAILURE;
+    }
+#ifdef STAGE1_CAN_RUN
+    std::cout.flush();
+    stage1Enter(entry);
+    std::cout.flush();
+#endif
+    return EXIT_SUCCESS;
+}
+
+int Compiler::enterPhase(int phase){
+    // The time so far goes to the phase being left, so each phase counts
+    // only its own work (parsing excludes the lexing it calls)
+    auto now = std::chrono::steady_clock::now();
+    if (stats.phase >= 0) stats.seconds[stats.phase] += std::chrono::duration<double>(now - stats.since).count();
+    int outer = stats.phase;
+    stats.phase = phase;
+    stats.since = now;
+    return outer;
+}
+
+void Compiler::leavePhase(int outer){
+    auto now = std::chrono::steady_clock::now();
+    stats.seconds[stats.phase] += std::chrono::duration<double>(now - stats.since).count();
+    stats.phase = outer;
+    stats.since = now;
+}
+
+void Compiler::reportStats(){
+    if (!stats.enabled) return;
+    static const char *const phaseNames[STAT_PHASES] = {
+        "lexing", "parsing", "ir", "codegen", "storage", "output"};
+    const std::pair<const char *, uint64_t> counters[] = {
+        {"tokens", stats.tokens},
+        {"symbols", symbolTable.size()},
+        {"temps", static_cast<uint64_t>(maxTempNo + 1)},
+        {"labels", ir.labelCount},
+        {"spills", stats.spills},
+        {"ir_instructions", ir.code.size()},
+        {"cse_eliminated", cseEliminated},
+        {"instructions", stats.instructions}};
+    double total = 0;
+    for (double t : stats.seconds) total += t;
+
+    if (stats.json) {
+        std::cerr << "{\"phases_ms\": {";
+        for (int k = 0; k < STAT_PHASES; ++k) {
+            std::cerr << (k ? ", " : "") << "\"" << phaseNames[k] << "\": " << stats.seconds[k] * 1000;
+        }
+        std::cerr << ", \"total\": " << total * 1000 << "}, \"counters\": {";
+        bool first = true;
+        for (const auto &c : counters) {
+            std::cerr << (first ? "" : ", ") << "\"" << c.first << "\": " << c.second;
+            first = false;
         }
+        std::cerr << "}}" << std::endl;
+        return;
+    }
+    std::cerr << std::left << std::setw(16) << "phase" << std::right << std::setw(12) << "ms"
+              << std::setw(8) << "%" << "\n" << std::fixed << std::setprecision(3);
+    for (int k = 0; k < STAT_PHASES; ++k) {
+        std::cerr << std::left << std::setw(16) << phaseNames[k] << std::right << std::setw(12)
+                  << stats.seconds[k] * 1000 << std::setw(8) << std::setprecision(1)
+                  << (total > 0 ? 100 * stats.seconds[k] / total : 0) << std::setprecision(3) << "\n";
+    }
+    std::cerr << std::left << std::setw(16) << "total" << std::right << std::setw(12) << total * 1000 << "\n";
+    for (const auto &c : counters) {
+        std::cerr << std::left << std::setw(16) << c.first << std::right << std::setw(12) << c.second << "\n";
+    }
+    std::cerr.unsetf(std::ios::floatfield);
+    std::cerr << std::flush;
+}
+
+/* ------------------------------------------------------
+    Trace events (--trace)
+    ------------------------------------------------------ */
+
+#ifdef __unix__
+static long processId(){ return static_cast<long>(getpid()); }
+#else
+static long processId(){ return 0; }
+#endif
+
+void TraceLog::begin(const char *name){
+    Open o = {name, clock::now()};
+    open.push_back(o);
+}
+
+void TraceLog::end(){
+    const Open &o = open.back();
+    clock::time_point now = clock::now();
+    double dur = std::chrono::duration<double, std::micro>(now - o.start).count();
+    if (dur < minMicros) {
+        Total &t = totals[o.name];
+        ++t.count;
+        t.micros += dur;
+    } else {
+        double ts = std::chrono::duration<double, std::micro>(o.start.time_since_epoch()).count();
+        Span span = {o.name, ts, dur};
+        spans.push_back(span);
     }
+    open.pop_back();
+}
+
+void TraceLog::write(ostream &out, const string &process) const{
+    // Complete ("X") events on one track per process. The steady clock is
+    // shared by concurrent compiles, so their traces line up when merged:
+    // jq -s '{traceEvents: map(.traceEvents[])}' *.json
+    std::string name;
+    for (char c : process) {
+        if (c == '"' || c == '\\') name += '\\';
+        name += c;
+    }
+    std::ostringstream under;
+    under << " (spans under " << minMicros << " us)";
+    const long pid = processId();
+    const std::string ids = ", \"pid\": " + std::to_string(pid) + ", \"tid\": " + std::to_string(pid);
+    out << std::fixed << std::setprecision(3);
+    out << "{\"traceEvents\": [\n";
+    out << "{\"name\": \"process_name\", \"ph\": \"M\"" << ids << ", \"args\": {\"name\": \"stage1 " << name << "\"}},\n";
+    out << "{\"name\": \"thread_name\", \"ph\": \"M\"" << ids << ", \"args\": {\"name\": \"" << name << "\"}}";
+    double last = 0;
+    for (const Span &span : spans) {
+        out << ",\n{\"name\": \"" << span.name << "\", \"ph\": \"X\", \"ts\": " << span.ts
+            << ", \"dur\": " << span.dur << ids << "}";
+        last = std::max(last, span.ts + span.dur);
+    }
+    // What fell under minMicros: one instant event per name at the end
+    for (const auto &t : totals) {
+        out << ",\n{\"name\": \"" << t.first << under.str() << "\", \"ph\": \"i\", \"s\": \"t\", \"ts\": "
+            << last << ids << ", \"args\": {\"count\": " << t.second.count << ", \"total_us\": "
+            << t.second.micros << "}}";
+    }
+    out << "\n], \"displayTimeUnit\": \"ms\"}\n";
 }
 
 /* ------------------------------------------------------
@@ -2271,22 +4416,28 @@ void Compiler::processError(string err){
 
 //////////////////// EXPANDED DURING STAGE 1
 
-void Compiler::freeTemp(){
-    // Only decrement if we actually have a temp allocated
-    if (currentTempNo > -1) {
+void Compiler::freeTemp(string temp){
+    // Temps die in whatever order the IR dictates, so keep a free pool
+    // rather than assuming the last one allocated is the first released
+    if (!isTemporary(temp)) return;
+    if (freeTempNos.insert(std::stoi(temp.substr(1))).second) {
         --currentTempNo;
     }
-    
 }
 
 
 string Compiler::getTemp(){
-    // Allocate a new temporary external name "Tn"
+    // Allocate a temporary external name "Tn", reusing the lowest free one
+    int tempNo = maxTempNo + 1;
+    if (!freeTempNos.empty()) {
+        tempNo = *freeTempNos.begin();
+        freeTempNos.erase(freeTempNos.begin());
+    }
     ++currentTempNo;
-    if (currentTempNo > maxTempNo) {
-        maxTempNo = currentTempNo;
+    if (tempNo > maxTempNo) {
+        maxTempNo = tempNo;
     }
-    std::string temp = "T" + std::to_string(currentTempNo);
+    std::string temp = "T" + std::to_string(tempNo);
 
     // If this temp is new, insert into symbol table as an INTEGER variable by default.
     // (Type may be adjusted later by code generation routines.)
@@ -5,6 +5,11 @@
 #include <string>
 #include <map>
 #include <stack>
+#include <set>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <chrono>
 using namespace std;
 const char END_OF_FILE = '$'; // arbitrary choice
 enum storeTypes {INTEGER, BOOLEAN, PROG_NAME, UNKNOWN};
@@ -79,14 +84,250 @@ string value;
 allocation alloc;
 int units;
 };
+// Abstract syntax tree. Nodes are bump-allocated into one contiguous vector
+// and link to each other by 32-bit index, so a whole program is a handful of
+// allocations and is released in one shot by clear().
+enum astKinds {AST_PROGRAM, AST_ASSIGN, AST_READ, AST_WRITE, AST_BINARY,
+AST_UNARY, AST_IDENT, AST_LITERAL};
+const uint32_t NO_NODE = 0xFFFFFFFF; // null link
+struct AstNode
+{
+uint8_t kind; // one of astKinds
+uint8_t op; // irOps of a unary or binary node (IR_ADD for unary +)
+uint8_t need; // temps needed to evaluate the node (Sethi-Ullman number)
+uint32_t text; // offset of operator, name or literal in the text pool
+uint32_t left; // first operand, or first element of a list
+uint32_t right; // second operand of a binary node
+uint32_t next; // next statement, read target or write operand
+uint32_t line; // source line, used for diagnostics
+};
+class AstArena
+{
+public:
+uint32_t newNode(astKinds k, string text, uint32_t line,
+uint32_t left = NO_NODE, uint32_t right = NO_NODE);
+AstNode &at(uint32_t n)
+{
+return nodes[n];
+}
+const AstNode &at(uint32_t n) const
+{
+return nodes[n];
+}
+const char *text(uint32_t n) const // spelling of node n
+{
+return &pool[nodes[n].text];
+}
+uint32_t size() const
+{
+return static_cast<uint32_t>(nodes.size());
+}
+size_t bytesUsed() const; // bytes reserved for nodes and text
+void clear(); // release every node at once
+private:
+uint32_t intern(const string &s); // one pool entry per distinct spelling
+vector<AstNode> nodes;
+vector<char> pool;
+unordered_map<string, uint32_t> interned;
+};
+// Three-address intermediate code. Every instruction that computes a value
+// defines a new temporary (t0, t1, ...) exactly once, so temporaries are in
+// SSA form; named variables stay in memory and are read and written by name.
+// Short-circuit and/or jump forward over their right operand; the label they
+// jump to is followed by a phi that picks the left value (jump taken) or the
+// right value (fell through).
+enum irOps {IR_ADD, IR_SUB, IR_MUL, IR_DIV, IR_MOD, IR_AND, IR_OR, IR_EQ, IR_NE,
+IR_LT, IR_LE, IR_GT, IR_GE, IR_NEG, IR_NOT, IR_STORE, IR_READ, IR_WRITE,
+IR_JUMPF, IR_JUMPT, IR_LABEL, IR_PHI};
+enum irOperandKinds {IR_NONE, IR_TEMP, IR_NAME, IR_CONST, IR_LABELNO};
+const uint32_t NO_TEMP = 0xFFFFFFFF; // instruction defines no temporary
+struct IrOperand
+{
+uint8_t kind; // one of irOperandKinds
+uint32_t index; // temp number, label number, or entry in the name table
+};
+struct IrInst
+{
+uint8_t op; // one of irOps
+uint8_t type; // storeTypes of the value computed, stored or written
+uint32_t dest; // temporary defined here, NO_TEMP if none
+IrOperand a; // first operand; the variable for IR_STORE and IR_READ
+IrOperand b; // second operand; the value for IR_STORE, target of a jump
+uint32_t line; // source line, used for diagnostics
+};
+class IrProgram
+{
+public:
+IrOperand operand(irOperandKinds k, const string &spelling); // name or const
+IrOperand temp(uint32_t t) const
+{
+IrOperand o = {IR_TEMP, t};
+return o;
+}
+IrOperand newLabel() // forward jump target
+{
+IrOperand o = {IR_LABELNO, labelCount++};
+return o;
+}
+const string &spelling(IrOperand o) const // name or literal of o
+{
+return names[o.index];
+}
+uint32_t nameCount() const
+{
+return static_cast<uint32_t>(names.size());
+}
+uint32_t append(irOps op, storeTypes type, IrOperand a, IrOperand b,
+uint32_t line, bool definesTemp);
+vector<IrInst> code;
+vector<uint8_t> tempTypes; // storeTypes of each temporary
+uint32_t labelCount = 0;
+private:
+vector<string> names;
+unordered_map<string, uint32_t> nameIndex;
+};
+// Relocatable ELF object built from the same lines the emit routines would
+// write for NASM: SECTION/global directives, labels, dd/db/resd/resb data and
+// the x86 instructions the code generator uses. BITS 64 switches to x86-64
+// encoding (REX prefixes, RIP-relative memory) and an ELF64 file. Names that
+// are never defined (ReadInt, WriteInt, Crlf, ...) become external symbols.
+class ElfObject
+{
+public:
+bool assemble(const string &label, const string &instruction,
+const string &operands); // false if the line cannot be encoded
+void write(ostream &out); // resolve references and write the .o file
+void *load(const string &entry, const unordered_map<string, void *> &externs,
+string &error); // --run: link into executable memory, address of entry or nullptr
+uint32_t textSize() const
+{
+return static_cast<uint32_t>(text.size());
+}
+private:
+enum sections {UNDEF, TEXT, DATA, BSS};
+struct Symbol
+{
+uint8_t section; // one of sections, UNDEF until the name is defined
+uint32_t offset; // within its section
+};
+struct Operand
+{
+uint8_t kind; // 'r' register, 'q' rax-rdi, 'i' immediate, 'm' memory, 's' symbol, 'a' register address
+uint8_t reg; // register number for 'r'
+uint8_t size; // 1 for byte [..] and al-bl, r8b-r15b; otherwise 4
+int64_t value; // immediate, or displacement added to the symbol
+uint32_t symbol; // label or variable for 'm' and 's'
+uint8_t base, index, scale; // 'a' (lea only): [base + index*scale + value], NO_REGISTER if absent
+};
+static const uint8_t NO_REGISTER = 0xFF;
+enum fixupKinds {ABSOLUTE, BRANCH, RIPREL}; // i386 address, call/jmp target, x86-64 data
+struct Fixup
+{
+uint32_t offset; // 32-bit field in .text
+uint32_t symbol;
+uint8_t kind; // one of fixupKinds
+};
+uint32_t symbolId(const string &name); // entry in symbols, added if new
+bool define(const string &name);
+bool instruction(const string &mnemonic, const string &operands);
+bool parseOperand(const char *p, const char *end, Operand &o); // text in [p, end)
+bool parseAddress(const char *p, const char *end, Operand &o); // registers inside [ ]
+void reference(const Operand &o, fixupKinds kind); // 32-bit field + fixup
+void rex(uint8_t reg, const Operand &rm); // REX prefix if r8d-r15d are involved
+void modrm(uint8_t digit, const Operand &rm); // ModRM (+disp32) for reg or memory
+void address(uint8_t reg, const Operand &a); // ModRM, SIB and displacement for an 'a' operand
+uint8_t bits = 32; // BITS directive
+vector<uint8_t> text, data;
+uint32_t bssSize = 0;
+uint32_t alignment[4] = {1, 16, 4, 4}; // per section; SECTION .data align=64 raises it
+uint8_t current = TEXT; // section receiving lines
+vector<Symbol> symbols; // in order of first appearance
+vector<string> symbolNames;
+unordered_map<string, uint32_t> symbolIndex;
+set<string> globals;
+vector<Fixup> fixups;
+};
+// Instruction forms the code generator chooses between, priced by formCosts
+// in stage1.cpp (bytes as ElfObject encodes them, and latency)
+enum insnForms {FORM_XOR_ZERO, FORM_MOV_IMM, FORM_LOAD, FORM_STORE, FORM_REG, FORM_ALU_IMM8,
+FORM_ALU_IMM32, FORM_RMW_IMM8, FORM_RMW_IMM32, FORM_IMUL_IMM8, FORM_IMUL_IMM32, FORM_SHIFT,
+FORM_LEA, FORM_LEA_DISP32};
+struct AsmLine // one instruction of a candidate sequence
+{
+insnForms form;
+string instruction;
+string operands;
+string comment;
+};
+// --stats: time per phase of the compiler and what it produced
+enum statPhases {STAT_LEX, STAT_PARSE, STAT_IR, STAT_CODEGEN, STAT_STORAGE, STAT_OUTPUT, STAT_PHASES};
+struct CompileStats
+{
+bool enabled = false; // phases are timed only when set
+bool json = false; // --stats=json
+int phase = -1; // phase being timed, -1 if none
+std::chrono::steady_clock::time_point since; // when it began or resumed
+double seconds[STAT_PHASES] = {};
+uint64_t tokens = 0; // nextToken() calls
+uint64_t spills = 0; // A register written back to make room
+uint64_t instructions = 0; // emitted into .text
+bool inText = false; // emit() is in SECTION .text
+};
+// --trace: Chrome trace-event spans (Perfetto, chrome://tracing) for the
+// grammar productions, IR passes and emit routines. Spans shorter than
+// minMicros are not recorded one by one, only counted and summed per name,
+// so tracing a huge program stays cheap.
+class TraceLog
+{
+public:
+bool enabled = false;
+double minMicros = 10; // --trace-min=N
+void begin(const char *name);
+void end();
+void write(ostream &out, const string &process) const; // process: track name
+private:
+typedef std::chrono::steady_clock clock;
+struct Open
+{
+const char *name;
+clock::time_point start;
+};
+struct Span
+{
+const char *name;
+double ts, dur; // microseconds on the steady clock, shared by all processes
+};
+struct Total
+{
+uint64_t count;
+double micros;
+};
+vector<Open> open; // spans begun and not yet ended
+vector<Span> spans;
+map<string, Total> totals; // spans under minMicros, by name
+};
+// One dd, db or resd placed by emitStorage(), for the --layout report
+struct StorageItem
+{
+string section; // .data or .bss
+string label; // internal name, ARGS or Sn
+string name; // what the line's comment says
+uint32_t offset; // within the section
+uint32_t bytes;
+uint refs; // [label] operands in the code
+};
 class Compiler
 {
 public:
 Compiler(char **argv); // constructor
 ~Compiler(); // destructor
+bool setOption(string opt); // command-line option after the three file names
+bool checkOptions(); // after the options: rejects conflicting ones, opens ObjectFileName
 void createListingHeader();
 void parser();
 void createListingTrailer();
+int run(); // --run: execute the compiled program; exit status for main
+void reportStats(); // --stats: table (or JSON) on stderr
 // Methods implementing the grammar productions
 void prog(); // stage 0, production 1
 void progStmt(); // stage 0, production 2
@@ -95,19 +336,14 @@ void vars(); // stage 0, production 4
 void beginEndStmt(); // stage 0, production 5
 void constStmts(); // stage 0, production 6
 void varStmts(); // stage 0, production 7
-string ids(); // stage 0, production 8
+vector<string> ids(); // stage 0, production 8
 void execStmts(); // stage 1, production 2
 void execStmt(); // stage 1, production 3
 void assignStmt(); // stage 1, production 4
 void readStmt(); // stage 1, production 5
 void writeStmt(); // stage 1, production 7
-void express(); // stage 1, production 9
-void expresses(); // stage 1, production 10
-void term(); // stage 1, production 11
-void terms(); // stage 1, production 12
-void factor(); // stage 1, production 13
-void factors(); // stage 1, production 14
-void part(); // stage 1, production 15
+void express(); // stage 1, productions 9-15 (expresses, term, terms, factor,
+// factors and part), iteratively with operatorStk and nodeStk
 // Helper functions for the Pascallite lexicon
 bool isKeyword(string s) const; // determines if s is a keyword
 bool isSpecialSymbol(char c) const; // determines if c is a special symbol
@@ -118,12 +354,16 @@ bool isLiteral(string s) const; // determines if s is a literal
 // Action routines
 void insert(string externalName, storeTypes inType, modes inMode,
 string inValue, allocation inAlloc, int inUnits);
+void insert(const vector<string> &names, storeTypes inType, modes inMode,
+string inValue, allocation inAlloc, int inUnits); // bulk form, one entry per name
 storeTypes whichType(string name); // tells which data type a name has
 string whichValue(string name); // tells which value a name has
 void code(string op, string operand1 = "", string operand2 = "");
+void code(irOps op, string operand1 = "", string operand2 = ""); // through a table of emit routines
 void pushOperator(string op);
 string popOperator();
 void pushOperand(string operand);
+void enterLiteral(string name); // symbol table entry, with storage, for a new literal
 string popOperand();
 // Emit Functions
 void emit(string label = "", string instruction = "", string operands = "",
@@ -131,8 +371,21 @@ string comment = "");
 void emitPrologue(string progName, string = "");
 void emitEpilogue(string = "", string = "");
 void emitStorage();
+string location(string internalName, bool sized = false); // operand text for
+// a symbol's storage: [name] (dword [name] if sized), or a temp's register;
+// byte [name] for a boolean variable under --pack-booleans. Counts a reference
+// to name, so call it only for an operand that is emitted
+string loadOp(string internalName) const; // mov, or movsx for a byte
+string storeOperands(string internalName); // [name], eax or byte [name], al
+string sourceOperand(string internalName); // [name], or edx after loading a byte into it
+bool pascalliteRuntime() const; // ReadInts, WriteInts and Exit are available
 void emitReadCode(string operand, string = "");
 void emitWriteCode(string operand, string = "");
+void emitReadListCode(const vector<string> &operands); // one ReadInts call
+void emitWriteListCode(const vector<string> &operands); // one WriteInts call
+void emitArgsCall(string routine, size_t count, string comment);
+void emitWriteStringCode(string text); // one WriteString call for preformatted output
+string argsLocation(size_t k); // k-th dword of ARGS, counted as a reference
 void emitAssignCode(string operand1, string operand2); // op2 = op1
 void emitAdditionCode(string operand1, string operand2); // op2 + op1
 void emitSubtractionCode(string operand1, string operand2); // op2 - op1
@@ -143,24 +396,45 @@ void emitNegationCode(string operand1, string = ""); // -op1
 void emitNotCode(string operand1, string = ""); // !op1
 void emitAndCode(string operand1, string operand2); // op2 && op1
 void emitOrCode(string operand1, string operand2); // op2 || op1
+void emitJumpIfFalseCode(string operand1, string operand2); // if !op1 goto op2
+void emitJumpIfTrueCode(string operand1, string operand2); // if op1 goto op2
 void emitEqualityCode(string operand1, string operand2); // op2 == op1
 void emitInequalityCode(string operand1, string operand2); // op2 != op1
 void emitLessThanCode(string operand1, string operand2); // op2 < op1
-void emitLessThanOrEqualToCode(string operand1, string operand2); // op2 <=
-op1
+void emitLessThanOrEqualToCode(string operand1, string operand2); // op2 <= op1
 void emitGreaterThanCode(string operand1, string operand2); // op2 > op1
-void emitGreaterThanOrEqualToCode(string operand1, string operand2); // op2
->= op1
+void emitGreaterThanOrEqualToCode(string operand1, string operand2); // op2 >= op1
+template <irOps op> void emitAccumulatorCode(string operand1, string operand2); // add, sub, imul, and, or
+template <irOps op> void emitComparisonCode(string operand1, string operand2); // IR_EQ .. IR_GE
+void emitAffineCode(string operand, int32_t multiplier, int32_t addend); // operand * multiplier + addend
+bool emitIncrementCode(string variable, int32_t addend); // in memory, false if eax is cheaper
+void emitCheapest(const vector<vector<AsmLine>> &candidates); // lowest formCosts total
 // Lexical routines
 char nextChar(); // returns the next character or END_OF_FILE marker
 string nextToken(); // returns the next token or END_OF_FILE marker
 // Other routines
 string genInternalName(storeTypes stype) const;
 void processError(string err);
-void freeTemp();
+void freeTemp(string temp); // return temp to the pool of free temporaries
 string getTemp();
 string getLabel();
 bool isTemporary(string s) const; // determines if s represents a temporary
+// Syntax tree routines
+void appendStmt(uint32_t stmt); // link stmt onto the program body
+void writeAst(ostream &out, uint32_t n, int indent) const; // JSON dump
+// Intermediate code routines
+void buildIr(); // translate the syntax tree into three-address code
+IrOperand buildExpr(uint32_t expr); // operand holding the value of expr
+storeTypes irType(IrOperand o); // data type of an IR operand
+IrOperand foldConstants(irOps op, storeTypes type, IrOperand a, IrOperand b); // IR_NONE if kept
+int32_t constValue(const string &literal) const; // value of an integer or boolean literal
+void verifyIr(); // check SSA form and typing of the IR
+void numberValues(); // remove operations that recompute an available value
+void initializeStores(); // turn first stores of constants into initial values
+void evaluatePrefix(); // run the code before the first read at compile time
+void lowerIr(); // generate x86 code for the IR via the emit routines
+void writeIr(ostream &out) const; // ir.txt dump
+void writeLayout(ostream &out) const; // layout.txt report
 private:
 map<string, SymbolTableEntry> symbolTable;
 ifstream sourceFile;
@@ -171,9 +445,71 @@ char ch; // the next character of the source file
 uint errorCount = 0; // total number of errors encountered
 uint lineNo = 0; // line numbers for the listing
 stack<string> operatorStk; // operator stack
+vector<uint32_t> operatorLines; // source line of each operatorStk entry
 stack<string> operandStk; // operand stack
-int currentTempNo = -1; // current temp number
+int currentTempNo = -1; // number of temps in use, less one
 int maxTempNo = -1; // max temp number
+set<int> freeTempNos; // temps released out of order, reused lowest first
+unordered_map<string, uint> references; // memory operands emitted, by internal name
 string contentsOfAReg; // symbolic contents of A register
+string elidedStore; // lowerIr(): temp left only in eax, the emit routines skip its store
+AstArena ast; // syntax tree of the program being compiled
+vector<uint32_t> nodeStk; // partially built expressions
+uint32_t astRoot = NO_NODE; // AST_PROGRAM node
+uint32_t lastStmt = NO_NODE; // tail of the statement list
+string astFileName; // --ast: where to dump the tree, empty if not wanted
+IrProgram ir; // intermediate code of the program being compiled
+string irFileName; // --ir: where to dump the IR, empty if not wanted
+string layoutFileName; // --layout: where to report the data layout
+vector<StorageItem> layout; // .data and .bss as emitStorage() placed them
+string objectFileName; // third command-line argument
+bool elfOutput = false; // --elf: write an ELF object instead of NASM source
+bool target64 = false; // --target=x86-64: 64-bit code, temps T0-T7 in r8d-r15d
+bool i386Requested = false; // --target=i386 was given last, which --run cannot honour
+bool ownRuntime = false; // --runtime=pascallite: i386 code calls runtime/pascallite.c
+bool packBooleans = false; // --pack-booleans: boolean variables take a byte
+set<string> byteStorage; // internal names of those variables
+uint ioArgs = 0; // dwords in ARGS, the block for ReadInts/WriteInts
+vector<string> writeStrings; // constant output, emitted as S0, S1, ... in .data
+unordered_map<string, uint32_t> writeStringIndex; // text -> index in writeStrings
+ElfObject elf; // object file being assembled when elfOutput
+bool runProgram = false; // --run: execute in-process instead of writing ObjectFileName
+uint cseEliminated = 0; // operations removed by numberValues()
+uint storesInitialized = 0; // stores removed by initializeStores()
+uint prefixEvaluated = 0; // IR instructions run by evaluatePrefix()
+string prefixOutput; // what they wrote
+map<string, int32_t> initialValues; // variables set before the program runs, by external name
+uint shortCircuits = 0; // and/or compiled with a jump over the right operand
+CompileStats stats;
+int enterPhase(int phase); // start timing phase; returns the one it pauses
+void leavePhase(int outer); // stop timing, resume outer
+TraceLog trace; // --trace
+string traceFileName; // --trace[=file]
+string sourceFileName; // first command-line argument, names the trace track
+struct TraceScope // one --trace span for a block; a single test when tracing is off
+{
+TraceLog &log;
+TraceScope(Compiler &c, const char *name) : log(c.trace)
+{
+if (log.enabled) log.begin(name);
+}
+~TraceScope()
+{
+if (log.enabled) log.end();
+}
+};
+struct PhaseScope // times a block as one phase; a single test when --stats is off
+{
+Compiler &compiler;
+int outer;
+PhaseScope(Compiler &c, int phase) : compiler(c), outer(c.stats.enabled ? c.enterPhase(phase) : -1)
+{
+}
+~PhaseScope()
+{
+if (compiler.stats.enabled) compiler.leavePhase(outer);
+}
+};
+friend class ComponentBench; // bench/micro.C
 };
 #endif